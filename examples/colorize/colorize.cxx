@@ -5,6 +5,7 @@
 #include <VigraQt/vigraqimage.hxx>
 #include <VigraQt/qimageviewer.hxx>
 #include <VigraQt/imagecaption.hxx>
+#include <VigraQt/imagestatistics.hxx>
 
 #include <QDragEnterEvent>
 #include <QDropEvent>
@@ -28,7 +29,7 @@ typedef vigra::BasicImage<PixelType> OriginalImage;
 struct ColorizePrivate
 {
     OriginalImage                originalImage;
-    vigra::FindMinMax<PixelType> minmax;
+    ImageStatistics              statistics;
     ColorMap                    *cm;
     ImageCaption                *imageCaption;
     double                       gamma;
@@ -75,11 +76,11 @@ void Colorize::load(const char *filename)
                   destImage(p->originalImage));
     }
 
-    p->minmax.reset();
-    vigra::inspectImage(srcImageRange(p->originalImage), p->minmax);
+    p->statistics.compute(p->originalImage.data(),
+                          p->originalImage.width(), p->originalImage.height());
 
-    p->cm->setDomain(p->minmax.min, p->minmax.max);
-    cme->setDomain(p->minmax.min, p->minmax.max);
+    p->cm->setDomain(p->statistics.min(), p->statistics.max());
+    cme->setDomain(p->statistics.min(), p->statistics.max());
 
     updateDisplay();
 
@@ -167,7 +168,8 @@ void Colorize::computeDisplay()
     transformImage(srcImageRange(p->originalImage),
                    destImage(displayImage),
                    GammaAndColorMap(
-                       p->gamma, p->minmax.min, p->minmax.max, p->cm));
+                       p->gamma, (PixelType)p->statistics.min(),
+                       (PixelType)p->statistics.max(), p->cm));
 
     imageViewer->setImage(displayImage.qImage());
 }
@@ -17,9 +17,19 @@ INSTALLS       = target headers
 HEADERS += \
 	vigraqt_export.hxx \
 	qimageviewer.hxx \
+	qimageviewergroup.hxx \
+	imagezoom.hxx \
+	qimageformattraits.hxx \
+	qimagebufferpool.hxx \
+	qimagetilesource.hxx \
+	qimagerawfilesource.hxx \
 	overlayviewer.hxx \
+	qimageviewrenderer.hxx \
 	fimageviewer.hxx \
+	scalarimageviewer.hxx \
+	floattobyte.hxx \
 	imagecaption.hxx \
+	imagestatistics.hxx \
 	vigraqimage.hxx \
 	qrgbvalue.hxx \
 	createqimage.hxx \
@@ -35,9 +45,18 @@ headers.files = $$HEADERS
 
 SOURCES += \
 	qimageviewer.cxx \
+	qimageviewergroup.cxx \
+	imagezoom.cxx \
+	qimageformattraits.cxx \
+	qimagebufferpool.cxx \
+	qimagetilesource.cxx \
+	qimagerawfilesource.cxx \
 	overlayviewer.cxx \
+	qimageviewrenderer.cxx \
 	fimageviewer.cxx \
+	floattobyte.cxx \
 	imagecaption.cxx \
+	imagestatistics.cxx \
 	colormap.cxx \
 	linear_colormap.cxx \
 	cmgradient.cxx \
@@ -2,31 +2,60 @@
 #include "qimageviewer.hxx"
 #include "vigraqimage.hxx"
 
-#include <vigra/inspectimage.hxx>
-#include <vigra/copyimage.hxx>
-#include <vigra/stdimagefunctions.hxx>
-
+#include <QEvent>
 #include <QImage>
 #include <QLayout>
+#include <QReadWriteLock>
+#include <QTimer>
 #include <QVBoxLayout>
 
-#include <math.h>
+#include <algorithm>
+
+// pixels remapped per event loop iteration by remapNextChunk():
+enum { RemapChunkPixels = 1 << 20 };
 
 FImageViewer::FImageViewer(QWidget* parent)
 : QWidget(parent),
   qimageviewer_(new QImageViewer(this)),
   image_(0),
   qByteImage_(0),
+  data_(0),
+  width_(0),
+  height_(0),
+  rowStride_(0),
+  pixelStride_(1),
+  remapTimer_(new QTimer(this)),
+  mappedMin_(0.0f),
+  mappedMax_(0.0f),
   autoScaleMode_(true),
   logarithmicMode_(false),
-  markingMode_(false)
+  markingMode_(false),
+  lowerPercentile_(0.0),
+  upperPercentile_(100.0),
+  imageMin_(0.0f),
+  imageMax_(0.0f)
 {
 	QLayout *imageLayout= new QVBoxLayout(this);
 	imageLayout->addWidget(qimageviewer_);
+
+	remapTimer_->setSingleShot(true);
+	connect(remapTimer_, SIGNAL(timeout()), SLOT(remapNextChunk()));
+
+	// remap newly visible parts (after panning, zooming, or
+	// resizing) before they are painted:
+	connect(qimageviewer_, SIGNAL(centerPixelChanged(QPointF)),
+			SLOT(remapVisible()));
+	connect(qimageviewer_, SIGNAL(zoomLevelChanged(int)),
+			SLOT(remapVisible()));
+	connect(qimageviewer_, SIGNAL(zoomFactorChanged(qreal)),
+			SLOT(remapVisible()));
+	qimageviewer_->installEventFilter(this);
 }
 
 FImageViewer::~FImageViewer()
 {
+	// (the viewer refers to qByteImage_'s pixels)
+	qimageviewer_->setImage(QImage());
 	delete qByteImage_;
 	delete image_;
 }
@@ -53,23 +82,67 @@ int FImageViewer::zoomedHeight() const
 
 const QImage &FImageViewer::displayedImage() const
 {
+	const_cast<FImageViewer *>(this)->finishRedisplay();
 	return qByteImage_->qImage();
 }
 
 void FImageViewer::setImage(const vigra::FImage &newImage)
 {
-	delete image_;
-	image_= new vigra::FImage(newImage);
+	if(image_ && image_->size() == newImage.size())
+		std::copy(newImage.begin(), newImage.end(), image_->begin());
+	else
+	{
+		delete image_;
+		image_= new vigra::FImage(newImage);
+	}
+
+	setView(image_->data(), image_->width(), image_->height(),
+			image_->width(), 1);
+}
+
+void FImageViewer::setImageView(const float *data, int width, int height,
+								int rowStride, int pixelStride)
+{
+	// the copy is no longer needed:
+	if(image_ && image_->data() != data)
+	{
+		delete image_;
+		image_ = 0;
+	}
+
+	setView(data, width, height, rowStride ? rowStride : width, pixelStride);
+}
+
+void FImageViewer::setView(const float *data, int width, int height,
+						   int rowStride, int pixelStride)
+{
+	aboutToSetView();
 
-    vigra::FindMinMax<float> minmax;
-    vigra::inspectImage(srcImageRange(*image_), minmax);
-	imageMin_= minmax.min;
-	imageMax_= minmax.max;
+	data_ = data;
+	width_ = width;
+	height_ = height;
+	rowStride_ = rowStride;
+	pixelStride_ = pixelStride;
+
+	statistics_.compute(data, width, height, rowStride, pixelStride);
+	showView();
+}
+
+void FImageViewer::showView()
+{
+	imageMin_ = (float)statistics_.min();
+	imageMax_ = (float)statistics_.max();
 	emit imageMinMaxChanged(imageMin_, imageMax_);
 
-    delete qByteImage_;
-	qByteImage_ = new vigra::QByteImage(image_->width(), image_->height());
-	preparePalette();
+	if(!qByteImage_ ||
+	   qByteImage_->width() != width_ || qByteImage_->height() != height_)
+	{
+		// (the viewer refers to the old buffer)
+		qimageviewer_->setImage(QImage());
+		delete qByteImage_;
+		qByteImage_ = new vigra::QByteImage(width_, height_);
+		preparePalette();
+	}
 
 	if(autoScaleMode_)
 	{
@@ -102,7 +175,20 @@ void FImageViewer::setAutoScaleMode(bool newMode)
 
 void FImageViewer::autoScale()
 {
-	displayMinMax(imageMin(), imageMax());
+	// (the percentiles are looked up in the cached histogram)
+	displayMinMax((float)statistics_.percentile(lowerPercentile_),
+				  (float)statistics_.percentile(upperPercentile_));
+}
+
+void FImageViewer::setAutoScalePercentiles(double lower, double upper)
+{
+	if(lower != lowerPercentile_ || upper != upperPercentile_)
+	{
+		lowerPercentile_ = lower;
+		upperPercentile_ = upper;
+		if(autoScaleMode_)
+			autoScale();
+	}
 }
 
 void FImageViewer::setLogarithmicMode(bool newMode)
@@ -135,65 +221,127 @@ void FImageViewer::displayMinMax(float min, float max)
 	}
 }
 
-struct FloatToByteFunctor
+void FImageViewer::redisplay(float min, float max)
+{
+    if(!qByteImage_)
+        return;
+
+	mappedMin_ = min;
+	mappedMax_ = max;
+	unmappedRegion_ = QRegion(0, 0, width_, height_);
+
+	// remap the visible part first (everything if the viewer is
+	// hidden, e.g. before the first show() or when used offscreen):
+	QRect visible(qimageviewer_->isVisible()
+				  ? visibleImageRect() : QRect(0, 0, width_, height_));
+	remap(visible);
+
+	// the viewer references the byte image's pixels (so that they are
+	// neither shared nor copied), and only has to be told about
+	// changes unless the palette changed:
+	const QImage &shown(qimageviewer_->originalImage());
+	const QImage &converted(qByteImage_->qImage());
+	if(shown.bits() == converted.bits() &&
+	   shown.colorTable() == converted.colorTable())
+		qimageviewer_->markDirty(visible);
+	else
+		qimageviewer_->setImageData(
+			const_cast<uchar *>(converted.bits()), converted.size(),
+			converted.bytesPerLine(), converted.format(),
+			converted.colorTable(), shown.size() == converted.size());
+
+	// (the rest is marked dirty again when it has been remapped)
+	if(!unmappedRegion_.isEmpty())
+		remapTimer_->start(0);
+	else
+		remapTimer_->stop();
+
+	//cerr << "redisplayed, emitting... " << min << "," << max << "\n";
+	emit displayedMinMaxChanged(min, max);
+}
+
+void FImageViewer::remap(const QRect &rect)
+{
+	QRect r(rect & QRect(0, 0, width_, height_));
+	if(r.isEmpty())
+		return;
+
+	{
+		// (background jobs of the viewer may read the pixels)
+		QWriteLocker locker(qimageviewer_->imageLock());
+		mapRect(r, qByteImage_->qImage());
+	}
+	unmappedRegion_ -= r;
+}
+
+FloatToByteMapping FImageViewer::mapping() const
 {
-	float offset_, scale_;
-	FloatToByteFunctor(float min, float max)
-		: offset_(-min), scale_(min==max? 1.0 : 255.0 / (max-min)) {};
-	uchar operator()(float f) const
-		{ return (uchar)(scale_ *(f + offset_)); }
-};
+	return FloatToByteMapping(
+		mappedMin_, mappedMax_, logarithmicMode_ ?
+		FloatToByteMapping::Logarithmic : FloatToByteMapping::Linear,
+		markingMode_);
+}
 
-struct FloatToByteMarkFunctor
+void FImageViewer::mapRect(const QRect &r, QImage &byteImage)
 {
-	float offset_, scale_, min_, max_;
-	FloatToByteMarkFunctor(float min, float max)
-		: offset_(-min), scale_(min==max? 1.0 : 254.0 / (max-min)),
-		  min_(min), max_(max) {};
-	uchar operator()(float f) const
-		{ return (f<min_)||(f>max_)? (uchar)255 : (uchar)(scale_ *(f + offset_)); }
-};
+	FloatToByteMapping m(mapping());
+	for(int y = r.top(); y <= r.bottom(); ++y)
+		m.mapRow(data_ + (qint64)y * rowStride_
+				 + (qint64)r.left() * pixelStride_, pixelStride_,
+				 byteImage.scanLine(y) + r.left(), r.width());
+}
 
-struct FloatToByteLogFunctor
+QRect FImageViewer::visibleImageRect() const
 {
-	float scale_;
-	FloatToByteLogFunctor(float max)
-		: scale_(255.0/log(max)) {};
-	uchar operator()(float f) const
-		{ return f<=1? 0: (uchar)(scale_*log(f)); }
-};
+	int margin = QImageViewer::TileSize;
+	return qimageviewer_->imageCoordinates(
+		qimageviewer_->contentsRect().adjusted(
+			-margin, -margin, margin, margin)) & QRect(0, 0, width_, height_);
+}
 
-struct FloatToByteLogMarkFunctor
+void FImageViewer::remapVisible()
 {
-	float scale_, max_;
-	FloatToByteLogMarkFunctor(float max)
-		: scale_(254.0/log(max)), max_(max) {};
-	uchar operator()(float f) const
-		{ return f<=max_? (f<=1? 0: (uchar)(scale_*log(f))) : 255; }
-};
+	if(unmappedRegion_.isEmpty())
+		return;
 
-void FImageViewer::redisplay(float min, float max)
+	// (the viewer is about to paint these parts anyway)
+	QRegion todo(unmappedRegion_ & visibleImageRect());
+	foreach(QRect const &r, todo.rects())
+	{
+		remap(r);
+		qimageviewer_->markDirtyBeforePaint(r);
+	}
+}
+
+void FImageViewer::remapNextChunk()
 {
-    if(!image_ || !qByteImage_)
-        return;
+	if(unmappedRegion_.isEmpty())
+		return;
 
-	if(!logarithmicMode_)
-		if(!markingMode_)
-			vigra::transformImage(srcImageRange(*image_), destImage(*qByteImage_),
-								  FloatToByteFunctor(min, max));
-		else
-			vigra::transformImage(srcImageRange(*image_), destImage(*qByteImage_),
-								  FloatToByteMarkFunctor(min, max));
-	else
-		if(!markingMode_)
-			vigra::transformImage(srcImageRange(*image_), destImage(*qByteImage_),
-								  FloatToByteLogFunctor(max));
-		else
-			vigra::transformImage(srcImageRange(*image_), destImage(*qByteImage_),
-								  FloatToByteLogMarkFunctor(max));
+	QRect r(unmappedRegion_.rects().first());
+	r.setHeight(std::min(
+		r.height(), std::max(1, (int)RemapChunkPixels / r.width())));
+	remap(r);
+	qimageviewer_->markDirty(r);
 
-    qimageviewer_->setImage(qByteImage_->qImage());
+	if(!unmappedRegion_.isEmpty())
+		remapTimer_->start(0);
+}
 
-	//cerr << "redisplayed, emitting... " << min << "," << max << "\n";
-	emit displayedMinMaxChanged(min, max);
+void FImageViewer::finishRedisplay()
+{
+	remapTimer_->stop();
+	foreach(QRect const &r, unmappedRegion_.rects())
+	{
+		remap(r);
+		qimageviewer_->markDirty(r);
+	}
+}
+
+bool FImageViewer::eventFilter(QObject *watched, QEvent *event)
+{
+	// (resize events are delivered before the resulting paint event)
+	if(watched == qimageviewer_ && event->type() == QEvent::Resize)
+		remapVisible();
+	return QWidget::eventFilter(watched, event);
 }
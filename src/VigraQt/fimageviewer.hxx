@@ -27,12 +27,17 @@
 #define FIMAGEVIEWER_HXX
 
 #include "vigraqt_export.hxx"
+#include "floattobyte.hxx"
+#include "imagestatistics.hxx"
 #include <qwidget.h>
 #include <qimage.h>
+#include <qregion.h>
 #include <vigra/stdimage.hxx>
+#include <vigra/multi_array.hxx>
 
 class QImage;
 class QImageViewer;
+class QTimer;
 namespace vigra { class QByteImage; }
 
 class VIGRAQT_EXPORT FImageViewer: public QWidget
@@ -56,42 +61,120 @@ public:
 	float displayMin() const { return displayMin_; }
 	float displayMax() const { return displayMax_; }
 
+	// (completes a pending redisplay, see finishRedisplay())
 	const QImage &displayedImage() const;
 	QImageViewer *imageViewer() const { return qimageviewer_; }
 
+	// statistics (incl. histogram) of the displayed float data
+	const ImageStatistics &statistics() const { return statistics_; }
+
 	bool autoScaleMode() const { return autoScaleMode_; }
+	double autoScaleLowerPercentile() const { return lowerPercentile_; }
+	double autoScaleUpperPercentile() const { return upperPercentile_; }
 	bool logarithmicMode() const { return logarithmicMode_; }
 	bool markingMode() const { return markingMode_; }
 
 public Q_SLOTS:
-	// display a copy of the given image
+	// display a copy of the given image (re-using the previous copy
+	// and display buffer if the size did not change)
 	virtual void setImage( const vigra::FImage &newImage );
 
+public:
+	/**
+	 * Display the given float data without copying it.  The data
+	 * must stay valid (and unchanged) until another image is set or
+	 * the viewer is destroyed; after changing it, call
+	 * setImageView() again.  rowStride and pixelStride are given in
+	 * floats (rowStride = 0 means width).  The 8-bit display buffer
+	 * is re-used (and the view retained) if the size did not change.
+	 */
+	void setImageView( const float *data, int width, int height,
+					   int rowStride = 0, int pixelStride = 1 );
+
+	template <class STRIDE>
+	void setImageView( vigra::MultiArrayView<2, float, STRIDE> const &view )
+	{
+		setImageView( view.data(), (int)view.shape(0), (int)view.shape(1),
+					  (int)view.stride(1), (int)view.stride(0) );
+	}
+
+public Q_SLOTS:
+
 	void setAutoScaleMode( bool newMode );
 	void autoScale();
+	// let autoScale() display the given percentiles of the data
+	// instead of its whole range (e.g. 0.5 and 99.5 to ignore a few
+	// outliers); the default is 0 and 100, i.e. min and max
+	void setAutoScalePercentiles( double lower, double upper );
 	void setLogarithmicMode( bool newMode );
 	void setMarkingMode( bool newMode );
 
 	void displayMinMax(float min, float max);
 
+	// remap all pixels not yet remapped by the last redisplay();
+	// redisplay() only remaps the visible part of the image
+	// immediately and the rest in small chunks from the event loop
+	// (or as it becomes visible)
+	void finishRedisplay();
+
 Q_SIGNALS:
 	void imageMinMaxChanged(float min, float max);
 	void displayedMinMaxChanged(float min, float max);
 
+protected Q_SLOTS:
+	void remapNextChunk();
+	// remap the not yet remapped pixels within visibleImageRect()
+	void remapVisible();
+
 protected:
 	void redisplay(float min, float max);
 
+	// remap the given rectangle of the image with the current window
+	void remap(const QRect &rect);
+	// the mapping of the current window
+	FloatToByteMapping mapping() const;
+	// map the given rectangle (within the image) into byteImage
+	// (overloaded by ScalarImageViewer for other pixel types)
+	virtual void mapRect(const QRect &rect, QImage &byteImage);
+	// the visible part of the image, with a margin of one tile
+	QRect visibleImageRect() const;
+
+	virtual bool eventFilter(QObject *watched, QEvent *event);
+
 	void preparePalette();
 
+	// show the view given by data_ etc. (see setImageView())
+	void setView( const float *data, int width, int height,
+				  int rowStride, int pixelStride );
+	// called by setView() before float data is shown (lets
+	// ScalarImageViewer release its data of other types)
+	virtual void aboutToSetView() {}
+	// show the data of size width_ x height_ described by
+	// statistics_ (called by setView())
+	void showView();
+
 protected:
 	QImageViewer *qimageviewer_;
-	vigra::FImage *image_;
+	vigra::FImage *image_; // copy made by setImage(), if any
 	vigra::QByteImage *qByteImage_;
 
+	// the displayed float data (referring to *image_ or the
+	// caller's buffer):
+	const float *data_;
+	int width_, height_, rowStride_, pixelStride_;
+
+	// pixels still showing the previous window, and the window
+	// being remapped:
+	QRegion unmappedRegion_;
+	QTimer *remapTimer_;
+	float mappedMin_, mappedMax_;
+
 	bool autoScaleMode_;
 	bool logarithmicMode_;
 	bool markingMode_;
 
+	ImageStatistics statistics_;
+	double lowerPercentile_, upperPercentile_;
 	float imageMin_, imageMax_;
 	float displayMin_, displayMax_;
 };
@@ -0,0 +1,435 @@
+#include "floattobyte.hxx"
+#include "imagezoom.hxx"
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define VIGRAQT_FLOAT_X86
+# include <immintrin.h>
+# define VIGRAQT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+typedef unsigned char uchar;
+typedef unsigned int uint32;
+
+// coefficients of the Cephes logf() approximation
+#define LOG_SQRTHF 0.707106781186547524f
+#define LOG_P0  7.0376836292e-2f
+#define LOG_P1 -1.1514610310e-1f
+#define LOG_P2  1.1676998740e-1f
+#define LOG_P3 -1.2420140846e-1f
+#define LOG_P4  1.4249322787e-1f
+#define LOG_P5 -1.6668057665e-1f
+#define LOG_P6  2.0000714765e-1f
+#define LOG_P7 -2.4999993993e-1f
+#define LOG_P8  3.3333331174e-1f
+#define LOG_Q1 -2.12194440e-4f
+#define LOG_Q2  0.693359375f
+
+/********************************************************************/
+/*                                                                  */
+/*                              kernels                             */
+/*                                                                  */
+/********************************************************************/
+
+// All kernels perform exactly the same float operations in the same
+// order as the scalar ones, so that the results do not depend on the
+// instruction set.
+struct FloatToByteKernels
+{
+        // natural logarithm of a positive, finite, normalized value
+    static inline float log(float x)
+    {
+        uint32 bits;
+        memcpy(&bits, &x, sizeof(bits));
+        float e = (float)((int)(bits >> 23) - 126);
+        bits = (bits & 0x007fffff) | 0x3f000000; // mantissa in [0.5, 1)
+        float m;
+        memcpy(&m, &bits, sizeof(m));
+
+        if(m < LOG_SQRTHF)
+        {
+            e = e - 1.0f;
+            m = (m - 1.0f) + m;
+        }
+        else
+            m = m - 1.0f;
+
+        float z = m * m;
+        float y = LOG_P0;
+        y = y * m + LOG_P1;
+        y = y * m + LOG_P2;
+        y = y * m + LOG_P3;
+        y = y * m + LOG_P4;
+        y = y * m + LOG_P5;
+        y = y * m + LOG_P6;
+        y = y * m + LOG_P7;
+        y = y * m + LOG_P8;
+        y = y * m * z;
+        y = y + e * LOG_Q1;
+        y = y - 0.5f * z;
+        float r = m + y;
+        return r + e * LOG_Q2;
+    }
+
+        // saturating conversion (NaN becomes 0)
+    static inline uchar clamp(float v)
+    {
+        v = v > 0.0f ? v : 0.0f;
+        v = v < 255.0f ? v : 255.0f;
+        return (uchar)(int)v;
+    }
+
+    template<bool MARK>
+    static inline uchar linear(const FloatToByteMapping &m, float f)
+    {
+        if(MARK && (f < m.min_ || f > m.max_))
+            return 255;
+        return clamp((f - m.min_) * m.scale_);
+    }
+
+    static inline uchar logarithmic(const FloatToByteMapping &m, float f)
+    {
+        if(f > m.max_)
+            return 255;
+        if(!(f > 1.0f))
+            return 0;
+        return clamp(log(f) * m.scale_);
+    }
+
+    static inline uchar map(const FloatToByteMapping &m, float f)
+    {
+        if(m.mode_ == FloatToByteMapping::Logarithmic)
+            return logarithmic(m, f);
+        return m.marking_ ? linear<true>(m, f) : linear<false>(m, f);
+    }
+
+    template<bool MARK>
+    static inline void linearTail(const FloatToByteMapping &m,
+                                  const float *s, uchar *d, int x, int w)
+    {
+        for(; x < w; ++x)
+            d[x] = linear<MARK>(m, s[x]);
+    }
+
+    static inline void logarithmicTail(const FloatToByteMapping &m,
+                                       const float *s, uchar *d, int x, int w)
+    {
+        for(; x < w; ++x)
+            d[x] = logarithmic(m, s[x]);
+    }
+
+    template<bool MARK>
+    static void linearScalar(const FloatToByteMapping &m,
+                             const float *s, uchar *d, int w)
+    {
+        linearTail<MARK>(m, s, d, 0, w);
+    }
+
+    static void logarithmicScalar(const FloatToByteMapping &m,
+                                  const float *s, uchar *d, int w)
+    {
+        logarithmicTail(m, s, d, 0, w);
+    }
+
+#ifdef VIGRAQT_FLOAT_X86
+
+    /****************************************************************/
+    /*                             SSE2                             */
+    /****************************************************************/
+
+    VIGRAQT_TARGET("sse2")
+    static inline __m128 logSSE2(__m128 x)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        __m128i bits = _mm_castps_si128(x);
+        __m128 e = _mm_cvtepi32_ps(
+            _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+        __m128 m = _mm_castsi128_ps(_mm_or_si128(
+            _mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+            _mm_set1_epi32(0x3f000000)));
+
+        __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(LOG_SQRTHF));
+        e = _mm_sub_ps(e, _mm_and_ps(small, one));
+        m = _mm_add_ps(_mm_sub_ps(m, one), _mm_and_ps(small, m));
+
+        __m128 z = _mm_mul_ps(m, m);
+        __m128 y = _mm_set1_ps(LOG_P0);
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P1));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P2));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P3));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P4));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P5));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P6));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P7));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P8));
+        y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+        y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(LOG_Q1)));
+        y = _mm_sub_ps(y, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+        __m128 r = _mm_add_ps(m, y);
+        return _mm_add_ps(r, _mm_mul_ps(e, _mm_set1_ps(LOG_Q2)));
+    }
+
+        // (maxps returns its second operand for NaN)
+    VIGRAQT_TARGET("sse2")
+    static inline __m128i clampSSE2(__m128 v)
+    {
+        v = _mm_max_ps(v, _mm_setzero_ps());
+        v = _mm_min_ps(v, _mm_set1_ps(255.0f));
+        return _mm_cvttps_epi32(v);
+    }
+
+        // v where mask is not set, 255 elsewhere
+    VIGRAQT_TARGET("sse2")
+    static inline __m128 markSSE2(__m128 v, __m128 mask)
+    {
+        return _mm_or_ps(_mm_andnot_ps(mask, v),
+                         _mm_and_ps(mask, _mm_set1_ps(255.0f)));
+    }
+
+    VIGRAQT_TARGET("sse2")
+    static inline void store16SSE2(uchar *d, const __m128i *q)
+    {
+        _mm_storeu_si128((__m128i *)d, _mm_packus_epi16(
+                             _mm_packs_epi32(q[0], q[1]),
+                             _mm_packs_epi32(q[2], q[3])));
+    }
+
+    template<bool MARK>
+    VIGRAQT_TARGET("sse2")
+    static void linearSSE2(const FloatToByteMapping &m,
+                           const float *s, uchar *d, int w)
+    {
+        const __m128 min = _mm_set1_ps(m.min_), max = _mm_set1_ps(m.max_),
+                   scale = _mm_set1_ps(m.scale_);
+        int x = 0;
+        for(; x + 16 <= w; x += 16)
+        {
+            __m128i q[4];
+            for(int i = 0; i < 4; ++i)
+            {
+                __m128 f = _mm_loadu_ps(s + x + 4*i);
+                __m128 v = _mm_mul_ps(_mm_sub_ps(f, min), scale);
+                if(MARK)
+                    v = markSSE2(v, _mm_or_ps(_mm_cmplt_ps(f, min),
+                                              _mm_cmpgt_ps(f, max)));
+                q[i] = clampSSE2(v);
+            }
+            store16SSE2(d + x, q);
+        }
+        linearTail<MARK>(m, s, d, x, w);
+    }
+
+    VIGRAQT_TARGET("sse2")
+    static void logarithmicSSE2(const FloatToByteMapping &m,
+                                const float *s, uchar *d, int w)
+    {
+        const __m128 one = _mm_set1_ps(1.0f), max = _mm_set1_ps(m.max_),
+                   scale = _mm_set1_ps(m.scale_);
+        int x = 0;
+        for(; x + 16 <= w; x += 16)
+        {
+            __m128i q[4];
+            for(int i = 0; i < 4; ++i)
+            {
+                __m128 f = _mm_loadu_ps(s + x + 4*i);
+                __m128 v = _mm_and_ps(_mm_mul_ps(logSSE2(f), scale),
+                                      _mm_cmpgt_ps(f, one));
+                v = _mm_max_ps(v, _mm_setzero_ps());
+                v = _mm_min_ps(v, _mm_set1_ps(255.0f));
+                q[i] = _mm_cvttps_epi32(markSSE2(v, _mm_cmpgt_ps(f, max)));
+            }
+            store16SSE2(d + x, q);
+        }
+        logarithmicTail(m, s, d, x, w);
+    }
+
+    /****************************************************************/
+    /*                             AVX2                             */
+    /****************************************************************/
+
+    VIGRAQT_TARGET("avx2")
+    static inline __m256 logAVX2(__m256 x)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        __m256i bits = _mm256_castps_si256(x);
+        __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+            _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+            _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+            _mm256_set1_epi32(0x3f000000)));
+
+        __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(LOG_SQRTHF), _CMP_LT_OQ);
+        e = _mm256_sub_ps(e, _mm256_and_ps(small, one));
+        m = _mm256_add_ps(_mm256_sub_ps(m, one), _mm256_and_ps(small, m));
+
+        __m256 z = _mm256_mul_ps(m, m);
+        __m256 y = _mm256_set1_ps(LOG_P0);
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P1));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P2));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P3));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P4));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P5));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P6));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P7));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(LOG_P8));
+        y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+        y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(LOG_Q1)));
+        y = _mm256_sub_ps(y, _mm256_mul_ps(_mm256_set1_ps(0.5f), z));
+        __m256 r = _mm256_add_ps(m, y);
+        return _mm256_add_ps(r, _mm256_mul_ps(e, _mm256_set1_ps(LOG_Q2)));
+    }
+
+    VIGRAQT_TARGET("avx2")
+    static inline __m256 markAVX2(__m256 v, __m256 mask)
+    {
+        return _mm256_blendv_ps(v, _mm256_set1_ps(255.0f), mask);
+    }
+
+        // pack 16 values (in [0, 255]) to bytes
+    VIGRAQT_TARGET("avx2")
+    static inline void store16AVX2(uchar *d, __m256i a, __m256i b)
+    {
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+        _mm_storeu_si128((__m128i *)d, _mm_packus_epi16(
+                             _mm256_castsi256_si128(p),
+                             _mm256_extracti128_si256(p, 1)));
+    }
+
+    template<bool MARK>
+    VIGRAQT_TARGET("avx2")
+    static void linearAVX2(const FloatToByteMapping &m,
+                           const float *s, uchar *d, int w)
+    {
+        const __m256 min = _mm256_set1_ps(m.min_),
+                    max = _mm256_set1_ps(m.max_),
+                  scale = _mm256_set1_ps(m.scale_),
+                   zero = _mm256_setzero_ps(),
+                    top = _mm256_set1_ps(255.0f);
+        int x = 0;
+        for(; x + 16 <= w; x += 16)
+        {
+            __m256i q[2];
+            for(int i = 0; i < 2; ++i)
+            {
+                __m256 f = _mm256_loadu_ps(s + x + 8*i);
+                __m256 v = _mm256_mul_ps(_mm256_sub_ps(f, min), scale);
+                if(MARK)
+                    v = markAVX2(v, _mm256_or_ps(
+                                     _mm256_cmp_ps(f, min, _CMP_LT_OQ),
+                                     _mm256_cmp_ps(f, max, _CMP_GT_OQ)));
+                v = _mm256_min_ps(_mm256_max_ps(v, zero), top);
+                q[i] = _mm256_cvttps_epi32(v);
+            }
+            store16AVX2(d + x, q[0], q[1]);
+        }
+        linearTail<MARK>(m, s, d, x, w);
+    }
+
+    VIGRAQT_TARGET("avx2")
+    static void logarithmicAVX2(const FloatToByteMapping &m,
+                                const float *s, uchar *d, int w)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f),
+                     max = _mm256_set1_ps(m.max_),
+                   scale = _mm256_set1_ps(m.scale_),
+                    zero = _mm256_setzero_ps(),
+                     top = _mm256_set1_ps(255.0f);
+        int x = 0;
+        for(; x + 16 <= w; x += 16)
+        {
+            __m256i q[2];
+            for(int i = 0; i < 2; ++i)
+            {
+                __m256 f = _mm256_loadu_ps(s + x + 8*i);
+                __m256 v = _mm256_and_ps(_mm256_mul_ps(logAVX2(f), scale),
+                                         _mm256_cmp_ps(f, one, _CMP_GT_OQ));
+                v = _mm256_min_ps(_mm256_max_ps(v, zero), top);
+                q[i] = _mm256_cvttps_epi32(
+                    markAVX2(v, _mm256_cmp_ps(f, max, _CMP_GT_OQ)));
+            }
+            store16AVX2(d + x, q[0], q[1]);
+        }
+        logarithmicTail(m, s, d, x, w);
+    }
+
+#endif // VIGRAQT_FLOAT_X86
+};
+
+/********************************************************************/
+/*                                                                  */
+/*                         FloatToByteMapping                       */
+/*                                                                  */
+/********************************************************************/
+
+FloatToByteMapping::FloatToByteMapping(float min, float max, Mode mode,
+                                       bool marking)
+: mode_(mode),
+  marking_(marking),
+  min_(min),
+  max_(max)
+{
+    float range = marking ? 254.0f : 255.0f;
+    if(mode == Logarithmic)
+        // (for max <= 1, everything is either black or above max)
+        scale_ = max > 1.0f ? range / FloatToByteKernels::log(max) : 0.0f;
+    else
+        scale_ = min == max ? 1.0f : range / (max - min);
+
+    if(mode == Logarithmic)
+        rowFunction_ = &FloatToByteKernels::logarithmicScalar;
+    else if(marking)
+        rowFunction_ = &FloatToByteKernels::linearScalar<true>;
+    else
+        rowFunction_ = &FloatToByteKernels::linearScalar<false>;
+
+#ifdef VIGRAQT_FLOAT_X86
+    ImageZoom::InstructionSet is = ImageZoom::instructionSet();
+    if(is >= ImageZoom::AVX2)
+    {
+        if(mode == Logarithmic)
+            rowFunction_ = &FloatToByteKernels::logarithmicAVX2;
+        else if(marking)
+            rowFunction_ = &FloatToByteKernels::linearAVX2<true>;
+        else
+            rowFunction_ = &FloatToByteKernels::linearAVX2<false>;
+    }
+    else if(is >= ImageZoom::SSE2)
+    {
+        if(mode == Logarithmic)
+            rowFunction_ = &FloatToByteKernels::logarithmicSSE2;
+        else if(marking)
+            rowFunction_ = &FloatToByteKernels::linearSSE2<true>;
+        else
+            rowFunction_ = &FloatToByteKernels::linearSSE2<false>;
+    }
+#endif
+}
+
+unsigned char FloatToByteMapping::operator()(float value) const
+{
+    return FloatToByteKernels::map(*this, value);
+}
+
+void FloatToByteMapping::mapRow(const float *src, int pixelStride,
+                                unsigned char *dest, int width) const
+{
+    if(pixelStride == 1)
+    {
+        rowFunction_(*this, src, dest, width);
+        return;
+    }
+
+    for(int x = 0; x < width; ++x, src += pixelStride)
+        dest[x] = FloatToByteKernels::map(*this, *src);
+}
+
+void FloatToByteMapping::mapRows(const float *data, int width,
+                                 int rowStride, int pixelStride,
+                                 unsigned char *destBits, int destBytesPerLine,
+                                 int beginRow, int endRow) const
+{
+    for(int y = beginRow; y < endRow; ++y)
+        mapRow(data + (int64_t)y * rowStride, pixelStride,
+               destBits + (int64_t)y * destBytesPerLine, width);
+}
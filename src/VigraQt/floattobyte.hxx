@@ -0,0 +1,81 @@
+#ifndef FLOATTOBYTE_HXX
+#define FLOATTOBYTE_HXX
+
+#include "vigraqt_export.hxx"
+
+/**
+ * Row kernels mapping float data to 8-bit display values, as used by
+ * FImageViewer.  The window [min, max] is mapped linearly or
+ * logarithmically (where ln(1) ... ln(max) is mapped to 0 ... 255 and
+ * values <= 1 are black) onto 0 ... 255; values outside the window
+ * saturate (NaN is mapped to 0).  In marking mode, the window is
+ * mapped onto 0 ... 254 and values outside it (for the logarithmic
+ * mapping: above max) are marked as 255.
+ *
+ * The logarithm is computed with a polynomial approximation (the one
+ * from the Cephes library, accurate to about one float ulp), which is
+ * used by all kernels so that they produce identical results.  The
+ * kernels are chosen at runtime like those of ImageZoom (and follow
+ * ImageZoom::setInstructionSet()): SSE2 or AVX2 on x86 for
+ * contiguous rows, with scalar fallbacks everywhere.
+ *
+ * FloatToByteMapping does not depend on Qt and may be used from any
+ * thread.
+ */
+class VIGRAQT_EXPORT FloatToByteMapping
+{
+  public:
+    enum Mode { Linear, Logarithmic };
+
+        /**
+         * Prepare the mapping of the window [min, max] with the given
+         * mode.  The kernels are chosen according to
+         * ImageZoom::instructionSet() at construction time.
+         */
+    FloatToByteMapping(float min, float max, Mode mode = Linear,
+                       bool marking = false);
+
+    Mode mode() const
+        { return mode_; }
+
+    bool marking() const
+        { return marking_; }
+
+        /**
+         * Map a single value (for reference; use mapRow() or
+         * mapRows() for whole images).
+         */
+    unsigned char operator()(float value) const;
+
+        /**
+         * Map 'width' values, 'pixelStride' floats apart, from src to
+         * the consecutive bytes at dest.
+         */
+    void mapRow(const float *src, int pixelStride,
+                unsigned char *dest, int width) const;
+
+        /**
+         * Map rows [beginRow, endRow) of the given float image of the
+         * given width into the 8-bit image destBits.  Strides are
+         * given in floats (rowStride, pixelStride) resp. bytes
+         * (destBytesPerLine).
+         */
+    void mapRows(const float *data, int width, int rowStride, int pixelStride,
+                 unsigned char *destBits, int destBytesPerLine,
+                 int beginRow, int endRow) const;
+
+  private:
+    friend struct FloatToByteKernels;
+
+    typedef void (*RowFunction)(const FloatToByteMapping &,
+                                const float *, unsigned char *, int);
+
+    Mode mode_;
+    bool marking_;
+    float min_, max_, scale_;
+
+        // kernel for contiguous rows:
+    RowFunction rowFunction_;
+};
+
+#endif // FLOATTOBYTE_HXX
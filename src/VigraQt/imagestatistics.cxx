@@ -0,0 +1,265 @@
+#include "imagestatistics.hxx"
+#include <QCoreApplication>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <limits>
+#include <string.h>
+
+// bands smaller than this are not worth a thread of their own:
+enum { MinBandPixels = 1 << 16 };
+
+// The bins are the upper 16 bits of the float bit patterns, mapped
+// such that their unsigned order is the order of the float values.
+static inline quint32 orderedKey(float value)
+{
+    quint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+static inline float keyValue(quint32 key)
+{
+    quint32 bits = (key & 0x80000000u) ? (key & 0x7fffffffu) : ~key;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+int ImageStatistics::bin(float value)
+{
+    return (int)(orderedKey(value) >> 16);
+}
+
+float ImageStatistics::binLowerBound(int bin)
+{
+    return keyValue((quint32)bin << 16);
+}
+
+float ImageStatistics::binUpperBound(int bin)
+{
+    return keyValue(((quint32)bin << 16) | 0xffffu);
+}
+
+template<class T>
+static inline bool isNaN(T)
+{
+    return false;
+}
+
+static inline bool isNaN(float v)
+{
+    return v != v;
+}
+
+static inline bool isNaN(double v)
+{
+    return v != v;
+}
+
+/********************************************************************/
+
+// QRunnable executing a task functor and signalling its completion
+template<class TASK>
+class StatisticsRunnable : public QRunnable
+{
+  public:
+    StatisticsRunnable(TASK &task, QSemaphore &done)
+    : task_(task), done_(done)
+    {}
+
+    virtual void run()
+    {
+        task_();
+        done_.release();
+    }
+
+  private:
+    TASK &task_;
+    QSemaphore &done_;
+};
+
+template<class T>
+struct StatisticsTask
+{
+    const T *data;
+    int width, rowStride, pixelStride, beginRow, endRow;
+
+    // results (the counts of a band fit into 32 bits, see compute()):
+    QVector<quint32> histogram;
+    T min, max;
+    qint64 count, nanCount;
+
+    void operator()()
+    {
+        typedef std::numeric_limits<T> Limits;
+        min = Limits::has_infinity ? Limits::infinity() : Limits::max();
+        max = Limits::has_infinity ? -Limits::infinity() : Limits::min();
+        count = nanCount = 0;
+
+        histogram.fill(0, ImageStatistics::BinCount);
+        quint32 *bins = histogram.data();
+        for(int y = beginRow; y < endRow; ++y)
+        {
+            const T *s = data + (qint64)y * rowStride;
+            for(int x = 0; x < width; ++x, s += pixelStride)
+            {
+                T v = *s;
+                if(isNaN(v))
+                {
+                    ++nanCount;
+                    continue;
+                }
+                if(v < min)
+                    min = v;
+                if(v > max)
+                    max = v;
+                ++bins[ImageStatistics::bin((float)v)];
+            }
+        }
+        count = (qint64)width * (endRow - beginRow) - nanCount;
+    }
+};
+
+/********************************************************************/
+
+ImageStatistics::ImageStatistics()
+: count_(0),
+  nanCount_(0),
+  min_(0.0),
+  max_(0.0),
+  threadCount_(std::max(1, QThread::idealThreadCount()))
+{
+}
+
+void ImageStatistics::clear()
+{
+    histogram_.clear();
+    count_ = nanCount_ = 0;
+    min_ = max_ = 0.0;
+}
+
+void ImageStatistics::setThreadCount(int count)
+{
+    threadCount_ = std::max(1, count);
+}
+
+template<class T>
+void ImageStatistics::compute(const T *data, int width, int height,
+                              int rowStride, int pixelStride)
+{
+    clear();
+    if(width <= 0 || height <= 0)
+        return;
+    if(!rowStride)
+        rowStride = width;
+
+    // only split the image into bands in the GUI thread: in a worker
+    // thread (e.g. of the global pool), waiting for bands that are
+    // still queued behind other blocked workers could deadlock
+    qint64 pixels = (qint64)width * height;
+    int threads = threadCount_;
+    QCoreApplication *app = QCoreApplication::instance();
+    if(!app || QThread::currentThread() != app->thread())
+        threads = 1;
+    int bands = (int)std::min<qint64>(std::min(threads, height),
+                                      std::max<qint64>(1, pixels / MinBandPixels));
+    // (each band must have less than 2^32 pixels)
+    bands = std::max(bands,
+                     (int)std::min<qint64>(height, (pixels >> 31) + 1));
+
+    QVector<StatisticsTask<T> > tasks(bands);
+    for(int i = 0; i < bands; ++i)
+    {
+        StatisticsTask<T> &task(tasks[i]);
+        task.data = data;
+        task.width = width;
+        task.rowStride = rowStride;
+        task.pixelStride = pixelStride;
+        task.beginRow = (int)((qint64)height * i / bands);
+        task.endRow = (int)((qint64)height * (i + 1) / bands);
+    }
+
+    // run all tasks on the global thread pool (the first one in the
+    // calling thread) and wait until they are finished
+    QSemaphore done;
+    for(int i = 1; i < bands; ++i)
+        QThreadPool::globalInstance()->start(
+            new StatisticsRunnable<StatisticsTask<T> >(tasks[i], done));
+    tasks[0]();
+    done.acquire(bands - 1);
+
+    histogram_.fill(0, BinCount);
+    qint64 *bins = histogram_.data();
+    bool first = true;
+    for(int i = 0; i < bands; ++i)
+    {
+        const StatisticsTask<T> &task(tasks[i]);
+        nanCount_ += task.nanCount;
+        if(!task.count)
+            continue;
+
+        count_ += task.count;
+        if(first || task.min < min_)
+            min_ = task.min;
+        if(first || task.max > max_)
+            max_ = task.max;
+        first = false;
+
+        const quint32 *taskBins = task.histogram.constData();
+        for(int b = 0; b < BinCount; ++b)
+            bins[b] += taskBins[b];
+    }
+
+    if(!count_)
+        histogram_.clear();
+}
+
+template void ImageStatistics::compute<unsigned char>(
+    const unsigned char *, int, int, int, int);
+template void ImageStatistics::compute<signed char>(
+    const signed char *, int, int, int, int);
+template void ImageStatistics::compute<short>(
+    const short *, int, int, int, int);
+template void ImageStatistics::compute<unsigned short>(
+    const unsigned short *, int, int, int, int);
+template void ImageStatistics::compute<int>(
+    const int *, int, int, int, int);
+template void ImageStatistics::compute<unsigned int>(
+    const unsigned int *, int, int, int, int);
+template void ImageStatistics::compute<float>(
+    const float *, int, int, int, int);
+template void ImageStatistics::compute<double>(
+    const double *, int, int, int, int);
+
+double ImageStatistics::percentile(double percent) const
+{
+    if(!count_)
+        return 0.0;
+    if(percent <= 0.0)
+        return min_;
+    if(percent >= 100.0)
+        return max_;
+
+    double rank = percent / 100.0 * count_;
+    const qint64 *bins = histogram_.constData();
+    qint64 below = 0;
+    int b = 0;
+    for(; b < BinCount - 1; ++b)
+    {
+        if(bins[b] && below + bins[b] >= rank)
+            break;
+        below += bins[b];
+    }
+
+    // interpolate within the part of the bin covered by the data:
+    double lower = binLowerBound(b), upper = binUpperBound(b);
+    if(!(lower >= min_))
+        lower = min_;
+    if(!(upper <= max_))
+        upper = max_;
+    double fraction = bins[b] ? (rank - below) / bins[b] : 1.0;
+    return lower + (upper - lower) * std::min(1.0, std::max(0.0, fraction));
+}
@@ -0,0 +1,122 @@
+#ifndef IMAGESTATISTICS_HXX
+#define IMAGESTATISTICS_HXX
+
+#include "vigraqt_export.hxx"
+#include <QVector>
+
+/**
+ * Minimum, maximum, and a fine histogram of scalar image data,
+ * computed in a single pass by several threads (on the global
+ * QThreadPool) when called from the GUI thread.  In other threads,
+ * compute() runs serially, so that it may be used by pool workers
+ * (e.g. with QtConcurrent) without waiting for the pool.
+ *
+ * The histogram has BinCount bins covering the whole float range with
+ * constant relative precision: the bins are given by the sign,
+ * exponent, and the upper 7 mantissa bits of the values (converted to
+ * float), i.e. each bin spans less than 1% of its values.
+ * percentile() interpolates linearly within the bins, so that
+ * percentiles of the data can be looked up without another pass,
+ * e.g. for robust contrast settings that ignore a few hot pixels.
+ *
+ * NaN values are not counted (see nanCount()).  compute() is
+ * available for the types marked in ImageStatisticsTraits.
+ */
+class VIGRAQT_EXPORT ImageStatistics
+{
+  public:
+    enum { BinCount = 65536 };
+
+    ImageStatistics();
+
+        /**
+         * Compute the statistics of the given data; rowStride and
+         * pixelStride are given in elements (rowStride = 0 means
+         * width).
+         */
+    template<class T>
+    void compute(const T *data, int width, int height,
+                 int rowStride = 0, int pixelStride = 1);
+
+        /**
+         * Forget the statistics (count() becomes 0).
+         */
+    void clear();
+
+        /**
+         * Return the number of threads used by compute() in the GUI
+         * thread (defaults to QThread::idealThreadCount()).
+         */
+    int threadCount() const
+        { return threadCount_; }
+
+    void setThreadCount(int count);
+
+        /**
+         * Return the number of (non-NaN) values counted.
+         */
+    qint64 count() const
+        { return count_; }
+
+    qint64 nanCount() const
+        { return nanCount_; }
+
+        /**
+         * Return the minimum / maximum value (0 if count() == 0).
+         */
+    double min() const
+        { return min_; }
+
+    double max() const
+        { return max_; }
+
+        /**
+         * Return the value below which the given percentage of the
+         * values lies (0 and 100 give min() and max()).
+         */
+    double percentile(double percent) const;
+
+        /**
+         * Return the counts of all BinCount bins (empty if count() == 0).
+         */
+    const QVector<qint64> &histogram() const
+        { return histogram_; }
+
+        /**
+         * Return the smallest / largest float value counted in the
+         * given bin.
+         */
+    static float binLowerBound(int bin);
+    static float binUpperBound(int bin);
+
+        /**
+         * Return the bin counting the given value.
+         */
+    static int bin(float value);
+
+  private:
+    QVector<qint64> histogram_;
+    qint64 count_, nanCount_;
+    double min_, max_;
+    int threadCount_;
+};
+
+/**
+ * Marks the types for which ImageStatistics::compute() is available.
+ */
+template<class T>
+struct ImageStatisticsTraits
+{
+    enum { isSupported = false };
+};
+
+template<> struct ImageStatisticsTraits<unsigned char>  { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<signed char>    { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<short>          { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<unsigned short> { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<int>            { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<unsigned int>   { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<float>          { enum { isSupported = true }; };
+template<> struct ImageStatisticsTraits<double>         { enum { isSupported = true }; };
+
+#endif // IMAGESTATISTICS_HXX
@@ -0,0 +1,961 @@
+#include "imagezoom.hxx"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define VIGRAQT_ZOOM_X86
+# include <immintrin.h>
+# define VIGRAQT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+typedef unsigned char uchar;
+typedef unsigned short uint16;
+typedef unsigned int uint32;
+
+/********************************************************************/
+/*                                                                  */
+/*                     instruction set selection                    */
+/*                                                                  */
+/********************************************************************/
+
+// (only called once, see supportedInstructionSet())
+static int detectInstructionSet()
+{
+    int result = ImageZoom::Scalar;
+#ifdef VIGRAQT_ZOOM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        result = ImageZoom::AVX2;
+    else if(__builtin_cpu_supports("ssse3"))
+        result = ImageZoom::SSSE3;
+    else if(__builtin_cpu_supports("sse2"))
+        result = ImageZoom::SSE2;
+#endif
+    return result;
+}
+
+ImageZoom::InstructionSet ImageZoom::supportedInstructionSet()
+{
+    // (the initialization of function-local statics is thread-safe)
+    static const int supported = detectInstructionSet();
+    return (InstructionSet)supported;
+}
+
+// instruction set chosen by setInstructionSet(), -1 for
+// supportedInstructionSet(); accessed atomically since new ImageZoom
+// objects may be created in any thread
+static int selectedInstructionSet_ = -1;
+
+#ifdef __GNUC__
+# define VIGRAQT_ATOMIC_LOAD(var) __atomic_load_n(&var, __ATOMIC_ACQUIRE)
+# define VIGRAQT_ATOMIC_STORE(var, value) __atomic_store_n(&var, value, __ATOMIC_RELEASE)
+#else
+# define VIGRAQT_ATOMIC_LOAD(var) (*(volatile int *)&var)
+# define VIGRAQT_ATOMIC_STORE(var, value) (*(volatile int *)&var = value)
+#endif
+
+ImageZoom::InstructionSet ImageZoom::instructionSet()
+{
+    int selected = VIGRAQT_ATOMIC_LOAD(selectedInstructionSet_);
+    if(selected < 0)
+        return supportedInstructionSet();
+    return (InstructionSet)selected;
+}
+
+void ImageZoom::setInstructionSet(InstructionSet is)
+{
+    VIGRAQT_ATOMIC_STORE(selectedInstructionSet_,
+                         (int)std::min(is, supportedInstructionSet()));
+}
+
+/********************************************************************/
+/*                                                                  */
+/*                              kernels                             */
+/*                                                                  */
+/********************************************************************/
+
+// Naming: magnifying kernels are called "magnify*", subsampling
+// kernels "subsample*"; the suffix gives the pixel size in bits.
+// Every kernel processes as much as possible with vector
+// instructions and finishes the row with the scalar index lookup.
+struct ImageZoomKernels
+{
+    static void copy(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        if(z.bytesPerPixel_ > 0)
+            s += z.index_[0] * z.bytesPerPixel_;
+        else
+            s += z.index_[0] / 8; // (only used for whole bytes)
+        memcpy(d, s, z.rowBytes());
+    }
+
+    template<class T>
+    static inline void lookup(const ImageZoom &z, const T *s, T *d, int x)
+    {
+        const int *index = &z.index_[0];
+        for(; x < z.width_; ++x)
+            d[x] = s[index[x]];
+    }
+
+    static void lookup8(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        lookup(z, s, d, 0);
+    }
+
+    static void lookup16(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        lookup(z, (const uint16 *)s, (uint16 *)d, 0);
+    }
+
+    static inline void lookup24(const ImageZoom &z, const uchar *s, uchar *d,
+                                int x)
+    {
+        const int *index = &z.index_[0];
+        for(d += 3*x; x < z.width_; ++x, d += 3)
+        {
+            const uchar *p = s + 3*index[x];
+            d[0] = p[0];
+            d[1] = p[1];
+            d[2] = p[2];
+        }
+    }
+
+    static void lookup24(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        lookup24(z, s, d, 0);
+    }
+
+    static void lookup32(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        lookup(z, (const uint32 *)s, (uint32 *)d, 0);
+    }
+
+        // finish a row of any byte-sized pixels, starting at column x
+    static inline void lookupTail(const ImageZoom &z, const uchar *s,
+                                  uchar *d, int x)
+    {
+        switch(z.bytesPerPixel_)
+        {
+          case 1:
+              lookup(z, s, d, x);
+              break;
+          case 2:
+              lookup(z, (const uint16 *)s, (uint16 *)d, x);
+              break;
+          case 3:
+              lookup24(z, s, d, x);
+              break;
+          default:
+              lookup(z, (const uint32 *)s, (uint32 *)d, x);
+        }
+    }
+
+        // 1-bit pixels, packed with the most (LSB = false) or least
+        // significant bit first
+    template<bool LSB>
+    static void lookup1(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        const int *index = &z.index_[0];
+        for(int x = 0; x < z.width_; x += 8, ++d)
+        {
+            int n = std::min(8, z.width_ - x), byte = 0;
+            for(int b = 0; b < n; ++b)
+            {
+                int i = index[x + b];
+                int bit = LSB ? (s[i >> 3] >> (i & 7)) & 1
+                              : (s[i >> 3] >> (7 - (i & 7))) & 1;
+                byte |= LSB ? bit << b : bit << (7 - b);
+            }
+            *d = (uchar)byte;
+        }
+    }
+
+    static void lookupGeneric(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        int bpp = z.bytesPerPixel_;
+        for(int x = 0; x < z.width_; ++x, d += bpp)
+            memcpy(d, s + z.index_[x] * bpp, bpp);
+    }
+
+        // blend two source rows with weight w/256 of the second one
+    static inline void blendTail(const uchar *a, const uchar *b, int w,
+                                 uchar *d, int i, int n)
+    {
+        for(; i < n; ++i)
+            d[i] = (uchar)((a[i] * (256 - w) + b[i] * w + 128) >> 8);
+    }
+
+    static void blend(const uchar *a, const uchar *b, int w, uchar *d, int n)
+    {
+        blendTail(a, b, w, d, 0, n);
+    }
+
+        // interpolate between the pixels at index_[x] and the next one
+    template<int BPP>
+    static inline void interpolate(const ImageZoom &z, const uchar *s,
+                                   uchar *d, int x)
+    {
+        const int *index = &z.index_[0];
+        const uchar *weights = &z.weights_[0];
+        for(d += x * BPP; x < z.width_; ++x, d += BPP)
+        {
+            const uchar *p = s + index[x] * BPP;
+            int w = weights[x];
+            for(int b = 0; b < BPP; ++b)
+                d[b] = (uchar)((p[b] * (256 - w) + p[b + BPP] * w + 128) >> 8);
+        }
+    }
+
+    static void interpolate8(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        interpolate<1>(z, s, d, 0);
+    }
+
+    static void interpolate24(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        interpolate<3>(z, s, d, 0);
+    }
+
+    static void interpolate32(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        interpolate<4>(z, s, d, 0);
+    }
+
+#ifdef VIGRAQT_ZOOM_X86
+
+    /****************************************************************/
+    /*                             SSE2                             */
+    /****************************************************************/
+
+        // fill runs of f >= 16 equal pixels with broadcast stores
+    VIGRAQT_TARGET("sse2")
+    static void magnify8SSE2(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        int f = z.factor_, w = z.width_, run = (f + 15) & ~15;
+        const uchar *sp = s + z.index_[0];
+        int x = 0;
+        for(; x + run <= w; x += f, ++sp)
+        {
+            __m128i v = _mm_set1_epi8((char)*sp);
+            for(int i = 0; i < f; i += 16)
+                _mm_storeu_si128((__m128i *)(d + x + i), v);
+        }
+        lookup(z, s, d, x);
+    }
+
+    VIGRAQT_TARGET("sse2")
+    static void magnify32SSE2(const ImageZoom &z, const uchar *s8, uchar *d8)
+    {
+        const uint32 *s = (const uint32 *)s8;
+        uint32 *d = (uint32 *)d8;
+        int f = z.factor_, w = z.width_, x = 0;
+        const uint32 *sp = s + z.index_[0];
+        if(f == 2)
+        {
+            for(; x + 8 <= w; x += 8, sp += 4)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)sp);
+                _mm_storeu_si128((__m128i *)(d + x), _mm_unpacklo_epi32(v, v));
+                _mm_storeu_si128((__m128i *)(d + x + 4), _mm_unpackhi_epi32(v, v));
+            }
+        }
+        else
+        {
+            int run = (f + 3) & ~3;
+            for(; x + run <= w; x += f, ++sp)
+            {
+                __m128i v = _mm_set1_epi32((int)*sp);
+                for(int i = 0; i < f; i += 4)
+                    _mm_storeu_si128((__m128i *)(d + x + i), v);
+            }
+        }
+        lookup(z, s, d, x);
+    }
+
+        // subsample by 2 or 4 by masking and packing
+    VIGRAQT_TARGET("sse2")
+    static void subsample8SSE2(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        int f = z.step_, w = z.width_, x = 0;
+        int left = z.index_[0], sw = z.sourceWidth_;
+        const uchar *sp = s + left;
+        if(f == 2)
+        {
+            __m128i lo = _mm_set1_epi16(0xff);
+            for(; x + 16 <= w && left + 2*x + 32 <= sw; x += 16, sp += 32)
+            {
+                __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)sp), lo);
+                __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(sp + 16)), lo);
+                _mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(a, b));
+            }
+        }
+        else // f == 4
+        {
+            __m128i lo = _mm_set1_epi32(0xff);
+            for(; x + 16 <= w && left + 4*x + 64 <= sw; x += 16, sp += 64)
+            {
+                __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)sp), lo);
+                __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(sp + 16)), lo);
+                __m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i *)(sp + 32)), lo);
+                __m128i e = _mm_and_si128(_mm_loadu_si128((const __m128i *)(sp + 48)), lo);
+                _mm_storeu_si128((__m128i *)(d + x),
+                                 _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                                  _mm_packs_epi32(c, e)));
+            }
+        }
+        lookup(z, s, d, x);
+    }
+
+    VIGRAQT_TARGET("sse2")
+    static void subsample32SSE2(const ImageZoom &z, const uchar *s8, uchar *d8)
+    {
+        // only used for step_ == 2
+        const uint32 *s = (const uint32 *)s8;
+        uint32 *d = (uint32 *)d8;
+        int w = z.width_, x = 0;
+        int left = z.index_[0], sw = z.sourceWidth_;
+        const uint32 *sp = s + left;
+        for(; x + 4 <= w && left + 2*x + 8 <= sw; x += 4, sp += 8)
+        {
+            __m128 a = _mm_loadu_ps((const float *)sp);
+            __m128 b = _mm_loadu_ps((const float *)(sp + 4));
+            _mm_storeu_ps((float *)(d + x),
+                          _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+        lookup(z, s, d, x);
+    }
+
+    VIGRAQT_TARGET("sse2")
+    static void blendSSE2(const uchar *a, const uchar *b, int w, uchar *d, int n)
+    {
+        const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+        const __m128i wa = _mm_set1_epi16((short)(256 - w));
+        const __m128i wb = _mm_set1_epi16((short)w);
+        int i = 0;
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+            __m128i lo = _mm_add_epi16(
+                _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                              _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)),
+                round);
+            __m128i hi = _mm_add_epi16(
+                _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                              _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)),
+                round);
+            _mm_storeu_si128((__m128i *)(d + i),
+                             _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+                                              _mm_srli_epi16(hi, 8)));
+        }
+        blendTail(a, b, w, d, i, n);
+    }
+
+        // interpolate two pixels per iteration; each 64-bit load
+        // fetches both neighbors
+    VIGRAQT_TARGET("sse2")
+    static void interpolate32SSE2(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        const int *index = &z.index_[0];
+        const uchar *weights = &z.weights_[0];
+        const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+        int x = 0;
+        for(; x + 2 <= z.width_; x += 2)
+        {
+            short wa = weights[x], wb = weights[x + 1];
+            __m128i pa = _mm_unpacklo_epi8(
+                _mm_loadl_epi64((const __m128i *)(s + 4*index[x])), zero);
+            __m128i pb = _mm_unpacklo_epi8(
+                _mm_loadl_epi64((const __m128i *)(s + 4*index[x + 1])), zero);
+            pa = _mm_mullo_epi16(pa, _mm_set_epi16(wa, wa, wa, wa, 256 - wa,
+                                                   256 - wa, 256 - wa, 256 - wa));
+            pb = _mm_mullo_epi16(pb, _mm_set_epi16(wb, wb, wb, wb, 256 - wb,
+                                                   256 - wb, 256 - wb, 256 - wb));
+            pa = _mm_add_epi16(pa, _mm_srli_si128(pa, 8));
+            pb = _mm_add_epi16(pb, _mm_srli_si128(pb, 8));
+            __m128i r = _mm_srli_epi16(
+                _mm_add_epi16(_mm_unpacklo_epi64(pa, pb), round), 8);
+            _mm_storel_epi64((__m128i *)(d + 4*x), _mm_packus_epi16(r, zero));
+        }
+        interpolate<4>(z, s, d, x);
+    }
+
+    /****************************************************************/
+    /*                            SSSE3                             */
+    /****************************************************************/
+
+        // magnify by small factors using the precomputed pshufb masks
+        // (for 24-bit pixels, chunks of 5 pixels are stored 15 bytes
+        // apart, each overwriting the unused last byte of the previous)
+    VIGRAQT_TARGET("ssse3")
+    static void magnifySSSE3(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        int bpp = z.bytesPerPixel_, chunkPixels = 16 / bpp;
+        int chunkBytes = chunkPixels * bpp;
+        const __m128i *masks = (const __m128i *)&z.shuffleMasks_[0];
+        for(int c = 0; c < z.vectorChunks_; ++c)
+        {
+            __m128i v = _mm_loadu_si128(
+                (const __m128i *)(s + z.index_[c * chunkPixels] * bpp));
+            _mm_storeu_si128((__m128i *)(d + chunkBytes*c),
+                             _mm_shuffle_epi8(v, _mm_loadu_si128(masks + c)));
+        }
+        lookupTail(z, s, d, z.vectorChunks_ * chunkPixels);
+    }
+
+    /****************************************************************/
+    /*                             AVX2                             */
+    /****************************************************************/
+
+    VIGRAQT_TARGET("avx2")
+    static void magnify8AVX2(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        int f = z.factor_, w = z.width_, run = (f + 31) & ~31;
+        const uchar *sp = s + z.index_[0];
+        int x = 0;
+        for(; x + run <= w; x += f, ++sp)
+        {
+            __m256i v = _mm256_set1_epi8((char)*sp);
+            for(int i = 0; i < f; i += 32)
+                _mm256_storeu_si256((__m256i *)(d + x + i), v);
+        }
+        lookup(z, s, d, x);
+    }
+
+    VIGRAQT_TARGET("avx2")
+    static void magnify32AVX2(const ImageZoom &z, const uchar *s8, uchar *d8)
+    {
+        const uint32 *s = (const uint32 *)s8;
+        uint32 *d = (uint32 *)d8;
+        int f = z.factor_, w = z.width_, run = (f + 7) & ~7;
+        const uint32 *sp = s + z.index_[0];
+        int x = 0;
+        for(; x + run <= w; x += f, ++sp)
+        {
+            __m256i v = _mm256_set1_epi32((int)*sp);
+            for(int i = 0; i < f; i += 8)
+                _mm256_storeu_si256((__m256i *)(d + x + i), v);
+        }
+        lookup(z, s, d, x);
+    }
+
+        // gather 32-bit words at the source positions and keep their
+        // low bytes
+    VIGRAQT_TARGET("avx2")
+    static void subsample8AVX2(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        const int *index = &z.index_[0];
+        int w = z.width_, sw = z.sourceWidth_, x = 0;
+        const __m256i lowBytes = _mm256_setr_epi8(
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m256i joinLanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+        for(; x + 8 <= w && index[x + 7] + 4 <= sw; x += 8)
+        {
+            __m256i v = _mm256_i32gather_epi32(
+                (const int *)s, _mm256_loadu_si256((const __m256i *)(index + x)), 1);
+            v = _mm256_permutevar8x32_epi32(
+                _mm256_shuffle_epi8(v, lowBytes), joinLanes);
+            _mm_storel_epi64((__m128i *)(d + x), _mm256_castsi256_si128(v));
+        }
+        lookup(z, s, d, x);
+    }
+
+    VIGRAQT_TARGET("avx2")
+    static void subsample32AVX2(const ImageZoom &z, const uchar *s8, uchar *d8)
+    {
+        const uint32 *s = (const uint32 *)s8;
+        uint32 *d = (uint32 *)d8;
+        const int *index = &z.index_[0];
+        int w = z.width_, x = 0;
+        for(; x + 8 <= w; x += 8)
+        {
+            __m256i v = _mm256_i32gather_epi32(
+                (const int *)s, _mm256_loadu_si256((const __m256i *)(index + x)), 4);
+            _mm256_storeu_si256((__m256i *)(d + x), v);
+        }
+        lookup(z, s, d, x);
+    }
+
+    VIGRAQT_TARGET("avx2")
+    static void blendAVX2(const uchar *a, const uchar *b, int w, uchar *d, int n)
+    {
+        const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi16(128);
+        const __m256i wa = _mm256_set1_epi16((short)(256 - w));
+        const __m256i wb = _mm256_set1_epi16((short)w);
+        int i = 0;
+        for(; i + 32 <= n; i += 32)
+        {
+            __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+            __m256i lo = _mm256_add_epi16(
+                _mm256_add_epi16(
+                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), wa),
+                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), wb)),
+                round);
+            __m256i hi = _mm256_add_epi16(
+                _mm256_add_epi16(
+                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), wa),
+                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), wb)),
+                round);
+            // (unpack and pack both work within 128-bit lanes)
+            _mm256_storeu_si256((__m256i *)(d + i),
+                                _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                                                    _mm256_srli_epi16(hi, 8)));
+        }
+        blendTail(a, b, w, d, i, n);
+    }
+
+        // gather both neighbors of eight pixels as 32-bit words
+        // (the row has four bytes of padding for that)
+    VIGRAQT_TARGET("avx2")
+    static void interpolate8AVX2(const ImageZoom &z, const uchar *s, uchar *d)
+    {
+        const int *index = &z.index_[0];
+        const uchar *weights = &z.weights_[0];
+        const __m256i lowByte = _mm256_set1_epi32(0xff);
+        const __m256i full = _mm256_set1_epi32(256), round = _mm256_set1_epi32(128);
+        const __m256i lowBytes = _mm256_setr_epi8(
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m256i joinLanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+        int x = 0;
+        for(; x + 8 <= z.width_; x += 8)
+        {
+            __m256i v = _mm256_i32gather_epi32(
+                (const int *)s, _mm256_loadu_si256((const __m256i *)(index + x)), 1);
+            __m256i w = _mm256_cvtepu8_epi32(
+                _mm_loadl_epi64((const __m128i *)(weights + x)));
+            __m256i r = _mm256_add_epi32(
+                _mm256_mullo_epi32(_mm256_and_si256(v, lowByte),
+                                   _mm256_sub_epi32(full, w)),
+                _mm256_mullo_epi32(
+                    _mm256_and_si256(_mm256_srli_epi32(v, 8), lowByte), w));
+            r = _mm256_srli_epi32(_mm256_add_epi32(r, round), 8);
+            r = _mm256_permutevar8x32_epi32(
+                _mm256_shuffle_epi8(r, lowBytes), joinLanes);
+            _mm_storel_epi64((__m128i *)(d + x), _mm256_castsi256_si128(r));
+        }
+        interpolate<1>(z, s, d, x);
+    }
+
+#endif // VIGRAQT_ZOOM_X86
+};
+
+/********************************************************************/
+/*                                                                  */
+/*                             ImageZoom                            */
+/*                                                                  */
+/********************************************************************/
+
+ImageZoom::ImageZoom(int zoomLevel, int left, int destWidth,
+                     int sourceWidth, int bytesPerPixel, int sourceShift)
+: zoomLevel_(zoomLevel),
+  factor_(zoomLevel >= 0 ? zoomLevel + 1 : 1 - zoomLevel),
+  width_(std::max(destWidth, 0)),
+  sourceWidth_(sourceWidth),
+  bytesPerPixel_(bytesPerPixel),
+  sourceShift_(zoomLevel >= 0 ? 0 : sourceShift),
+  fixedStep_(0),
+  sourceHeight_(0),
+  bilinear_(false),
+  index_(width_ + 1),
+  spanBegin_(0),
+  spanEnd_(0),
+  step_(0),
+  vectorChunks_(0),
+  blendFunction_(0)
+{
+    // column index table (replaces the per-pixel division):
+    if(zoomLevel_ >= 0)
+    {
+        for(int x = 0, sx = left, run = 0; x < width_; ++x)
+        {
+            index_[x] = sx;
+            if(++run == factor_)
+            {
+                ++sx;
+                run = 0;
+            }
+        }
+    }
+    else
+    {
+        for(int x = 0; x < width_; ++x)
+            index_[x] = (left + x * factor_) >> sourceShift_;
+
+        // pyramid levels may lead to irregular sampling positions,
+        // which only the lookup/gather kernels can handle:
+        step_ = width_ > 1 ? index_[1] - index_[0] : 1;
+        for(int x = 2; x < width_ && step_; ++x)
+            if(index_[x] - index_[x-1] != step_)
+                step_ = 0;
+    }
+    index_[width_] = index_[width_ ? width_ - 1 : 0];
+
+    chooseRowFunction();
+}
+
+ImageZoom::ImageZoom(int64_t step, int left, int destWidth,
+                     int sourceWidth, int sourceHeight, int bytesPerPixel,
+                     int sourceShift, bool bilinear)
+: zoomLevel_(0),
+  factor_(1),
+  width_(std::max(destWidth, 0)),
+  sourceWidth_(sourceWidth),
+  bytesPerPixel_(bytesPerPixel),
+  sourceShift_(sourceShift),
+  fixedStep_(step),
+  sourceHeight_(sourceHeight),
+  bilinear_(bilinear && (bytesPerPixel == 1 || bytesPerPixel == 3 ||
+                         bytesPerPixel == 4)),
+  index_(width_ + 1),
+  spanBegin_(0),
+  spanEnd_(0),
+  step_(0),
+  vectorChunks_(0),
+  blendFunction_(0)
+{
+    if(bilinear_)
+    {
+        weights_.resize(width_ + 1);
+        for(int x = 0; x < width_; ++x)
+        {
+            // interpolate at the pixel center's source position
+            // (minus 0.5, since source pixel centers are at +0.5):
+            int64_t u = (((left + x) * step + step / 2) >> sourceShift_)
+                        - ((int64_t)1 << 31);
+            int sx = (int)(u >> 32), w = (int)(u >> 24) & 255;
+            if(sx < 0)
+                sx = w = 0;
+            else if(sx >= sourceWidth_ - 1)
+            {
+                sx = sourceWidth_ - 1;
+                w = 0;
+            }
+            index_[x] = sx;
+            weights_[x] = (unsigned char)w;
+        }
+
+        // the interpolation kernels read from a row buffer with the
+        // (vertically interpolated) source columns needed:
+        if(width_)
+        {
+            spanBegin_ = index_[0];
+            spanEnd_ = index_[width_ - 1] + 2;
+        }
+        for(int x = 0; x < width_; ++x)
+            index_[x] -= spanBegin_;
+        index_[width_] = index_[width_ ? width_ - 1 : 0];
+        weights_[width_] = 0;
+
+        chooseInterpolationFunctions();
+        return;
+    }
+
+    for(int x = 0; x < width_; ++x)
+        index_[x] = (int)(((left + x) * step + step / 2) >> (32 + sourceShift));
+
+    if(step > ((int64_t)1 << 32))
+    {
+        step_ = width_ > 1 ? index_[1] - index_[0] : 1;
+        for(int x = 2; x < width_ && step_; ++x)
+            if(index_[x] - index_[x-1] != step_)
+                step_ = 0;
+    }
+    index_[width_] = index_[width_ ? width_ - 1 : 0];
+
+    chooseRowFunction();
+}
+
+int64_t ImageZoom::fixedStep(double zoomFactor)
+{
+    return (int64_t)(4294967296.0 / zoomFactor + 0.5);
+}
+
+int ImageZoom::zoomedCoordinate(int64_t step, int source)
+{
+    // solve (zoomed * step + step / 2) >> 32 >= source for the
+    // smallest zoomed, then fix rounding errors:
+    int zoomed = (int)floor((((double)source * 4294967296.0) - step / 2)
+                            / (double)step);
+    while(sourceCoordinate(step, zoomed) >= source)
+        --zoomed;
+    while(sourceCoordinate(step, zoomed) < source)
+        ++zoomed;
+    return zoomed;
+}
+
+void ImageZoom::chooseInterpolationFunctions()
+{
+    InstructionSet is = instructionSet();
+    (void)is;
+
+    blendFunction_ = &ImageZoomKernels::blend;
+    if(bytesPerPixel_ == 1)
+        rowFunction_ = &ImageZoomKernels::interpolate8;
+    else if(bytesPerPixel_ == 3)
+        rowFunction_ = &ImageZoomKernels::interpolate24;
+    else
+        rowFunction_ = &ImageZoomKernels::interpolate32;
+
+#ifdef VIGRAQT_ZOOM_X86
+    if(is >= AVX2)
+        blendFunction_ = &ImageZoomKernels::blendAVX2;
+    else if(is >= SSE2)
+        blendFunction_ = &ImageZoomKernels::blendSSE2;
+
+    if(bytesPerPixel_ == 1 && is >= AVX2)
+        rowFunction_ = &ImageZoomKernels::interpolate8AVX2;
+    else if(bytesPerPixel_ == 4 && is >= SSE2)
+        rowFunction_ = &ImageZoomKernels::interpolate32SSE2;
+#endif
+}
+
+void ImageZoom::chooseRowFunction()
+{
+    InstructionSet is = instructionSet();
+    (void)is;
+
+    bool unzoomed = (zoomLevel_ == 0 && !fixedStep_) || step_ == 1;
+    if(bytesPerPixel_ < 0)
+    {
+        // 1-bit pixels can only be copied if they start at a byte:
+        if(unzoomed && !(index_[0] & 7))
+            rowFunction_ = &ImageZoomKernels::copy;
+        else if(bytesPerPixel_ == MonoLSB)
+            rowFunction_ = &ImageZoomKernels::lookup1<true>;
+        else
+            rowFunction_ = &ImageZoomKernels::lookup1<false>;
+        return;
+    }
+
+    if(unzoomed)
+    {
+        rowFunction_ = &ImageZoomKernels::copy;
+        return;
+    }
+
+    switch(bytesPerPixel_)
+    {
+      case 1:
+          rowFunction_ = &ImageZoomKernels::lookup8;
+          break;
+      case 2:
+          rowFunction_ = &ImageZoomKernels::lookup16;
+          break;
+      case 3:
+          rowFunction_ = &ImageZoomKernels::lookup24;
+          break;
+      case 4:
+          rowFunction_ = &ImageZoomKernels::lookup32;
+          break;
+      default:
+          rowFunction_ = &ImageZoomKernels::lookupGeneric;
+          return;
+    }
+
+#ifdef VIGRAQT_ZOOM_X86
+    if(fixedStep_ && fixedStep_ < ((int64_t)1 << 32))
+    {
+        // magnifying by arbitrary factors leads to irregular runs,
+        // which the pshufb masks handle fine:
+        if(is >= SSSE3)
+        {
+            computeShuffleMasks(sourceWidth_);
+            rowFunction_ = &ImageZoomKernels::magnifySSSE3;
+        }
+        return;
+    }
+
+    if(bytesPerPixel_ == 2 || bytesPerPixel_ == 3)
+    {
+        // no dedicated kernels; subsampling uses the scalar lookup:
+        if(zoomLevel_ > 0 && is >= SSSE3)
+        {
+            computeShuffleMasks(sourceWidth_);
+            rowFunction_ = &ImageZoomKernels::magnifySSSE3;
+        }
+        return;
+    }
+
+    int f = factor_;
+    if(bytesPerPixel_ == 1)
+    {
+        if(zoomLevel_ > 0)
+        {
+            if(is >= AVX2 && f >= 32)
+                rowFunction_ = &ImageZoomKernels::magnify8AVX2;
+            else if(is >= SSE2 && f >= 16)
+                rowFunction_ = &ImageZoomKernels::magnify8SSE2;
+            else if(is >= SSSE3)
+            {
+                computeShuffleMasks(sourceWidth_);
+                rowFunction_ = &ImageZoomKernels::magnifySSSE3;
+            }
+        }
+        else
+        {
+            if(is >= SSE2 && (step_ == 2 || step_ == 4))
+                rowFunction_ = &ImageZoomKernels::subsample8SSE2;
+            else if(is >= AVX2)
+                rowFunction_ = &ImageZoomKernels::subsample8AVX2;
+        }
+    }
+    else
+    {
+        if(zoomLevel_ > 0)
+        {
+            if(is >= AVX2 && f >= 8)
+                rowFunction_ = &ImageZoomKernels::magnify32AVX2;
+            else if(is >= SSSE3 && f == 3)
+            {
+                computeShuffleMasks(sourceWidth_);
+                rowFunction_ = &ImageZoomKernels::magnifySSSE3;
+            }
+            else if(is >= SSE2 && f != 3)
+                rowFunction_ = &ImageZoomKernels::magnify32SSE2;
+        }
+        else
+        {
+            if(is >= AVX2)
+                rowFunction_ = &ImageZoomKernels::subsample32AVX2;
+            else if(is >= SSE2 && step_ == 2)
+                rowFunction_ = &ImageZoomKernels::subsample32SSE2;
+        }
+    }
+#endif
+}
+
+void ImageZoom::computeShuffleMasks(int sourceWidth)
+{
+    int bpp = bytesPerPixel_, chunkPixels = 16 / bpp;
+    // if chunks do not fill 16 bytes (24-bit pixels), the last store
+    // must be followed by at least one pixel of the tail:
+    int chunks = (16 % bpp ? width_ - 1 : width_) / chunkPixels;
+
+    // (unused mask bytes are 0x80, which yields 0)
+    shuffleMasks_.assign(16 * std::max(chunks, 1), 0x80);
+    vectorChunks_ = 0;
+    for(int c = 0; c < chunks; ++c)
+    {
+        int base = index_[c * chunkPixels];
+        // the 16-byte load must stay within the source row:
+        if(base * bpp + 16 > sourceWidth * bpp)
+            break;
+        for(int p = 0; p < chunkPixels; ++p)
+            for(int b = 0; b < bpp; ++b)
+                shuffleMasks_[16*c + p*bpp + b] =
+                    (uchar)((index_[c * chunkPixels + p] - base) * bpp + b);
+        vectorChunks_ = c + 1;
+    }
+}
+
+void ImageZoom::zoomRows(const uchar *srcBits, int srcBytesPerLine, int top,
+                         uchar *destBits, int destBytesPerLine,
+                         int beginRow, int endRow) const
+{
+    if(bilinear_)
+    {
+        zoomRowsBilinear(srcBits, srcBytesPerLine, top,
+                         destBits, destBytesPerLine, beginRow, endRow);
+        return;
+    }
+
+    int lastSourceRow = -1;
+    const uchar *lastDestRow = 0;
+    for(int y = beginRow; y < endRow; ++y)
+    {
+        int sy = sourceRow(top, y);
+        uchar *d = destBits + y * destBytesPerLine;
+        if(sy == lastSourceRow)
+            memcpy(d, lastDestRow, rowBytes());
+        else
+            zoomRow(srcBits + sy * srcBytesPerLine, d);
+        lastSourceRow = sy;
+        lastDestRow = d;
+    }
+}
+
+void ImageZoom::zoomRowsBilinear(const uchar *srcBits, int srcBytesPerLine,
+                                 int top, uchar *destBits,
+                                 int destBytesPerLine,
+                                 int beginRow, int endRow) const
+{
+    int bpp = bytesPerPixel_;
+    // source columns available (the last one needed may be outside):
+    int available = (std::min(spanEnd_, sourceWidth_) - spanBegin_) * bpp;
+
+    // vertically interpolated source row (with room for the right
+    // neighbor of the last column and the 32-bit gathers):
+    std::vector<uchar> line((spanEnd_ - spanBegin_) * bpp + 4);
+
+    int lastSourceRow = -1, lastWeight = -1;
+    const uchar *lastDestRow = 0;
+    for(int y = beginRow; y < endRow; ++y)
+    {
+        int64_t v = (((top + y) * fixedStep_ + fixedStep_ / 2) >> sourceShift_)
+                    - ((int64_t)1 << 31);
+        int sy = (int)(v >> 32), w = (int)(v >> 24) & 255;
+        if(sy < 0)
+            sy = w = 0;
+        else if(sy >= sourceHeight_ - 1)
+        {
+            sy = sourceHeight_ - 1;
+            w = 0;
+        }
+
+        uchar *d = destBits + y * destBytesPerLine;
+        if(sy == lastSourceRow && w == lastWeight)
+        {
+            memcpy(d, lastDestRow, width_ * bpp);
+            continue;
+        }
+
+        const uchar *s0 = srcBits + sy * srcBytesPerLine + spanBegin_ * bpp;
+        if(w)
+            blendFunction_(s0, s0 + srcBytesPerLine, w, &line[0], available);
+        else
+            memcpy(&line[0], s0, available);
+        if(available < (spanEnd_ - spanBegin_) * bpp)
+            memcpy(&line[available], &line[available - bpp], bpp);
+
+        rowFunction_(*this, &line[0], d);
+        lastSourceRow = sy;
+        lastWeight = w;
+        lastDestRow = d;
+    }
+}
+
+void ImageZoom::reduce(const uchar *srcBits, int srcBytesPerLine,
+                       int srcWidth, int srcHeight,
+                       uchar *destBits, int destBytesPerLine,
+                       int left, int top, int width, int height,
+                       int bytesPerPixel, bool average)
+{
+    int bpp = bytesPerPixel;
+    for(int y = top; y < top + height; ++y)
+    {
+        const uchar *s0 = srcBits + 2*y * srcBytesPerLine;
+        const uchar *s1 = srcBits
+                          + std::min(2*y + 1, srcHeight - 1) * srcBytesPerLine;
+        uchar *d = destBits + y * destBytesPerLine + left * bpp;
+
+        for(int x = left; x < left + width; ++x)
+        {
+            int x0 = 2*x * bpp, x1 = std::min(2*x + 1, srcWidth - 1) * bpp;
+            if(average)
+            {
+                for(int b = 0; b < bpp; ++b, ++d)
+                    *d = (uchar)((s0[x0+b] + s0[x1+b] +
+                                  s1[x0+b] + s1[x1+b] + 2) >> 2);
+            }
+            else
+            {
+                memcpy(d, s0 + x0, bpp);
+                d += bpp;
+            }
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#ifndef IMAGEZOOM_HXX
+#define IMAGEZOOM_HXX
+
+#include "vigraqt_export.hxx"
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Row kernels for zooming raw image data by the integer zoom levels
+ * used by QImageViewerBase (N >= 0 means magnification by N+1, N < 0
+ * means subsampling by -N+1).
+ *
+ * An ImageZoom object precomputes the source column of every
+ * destination pixel (and some tables for the vectorized kernels), so
+ * it should be constructed once per zoomed region and then be used
+ * for all of its rows.  The best kernels supported by the CPU are
+ * chosen at runtime (SSE2, SSSE3, or AVX2 on x86, with scalar
+ * fallbacks everywhere).  Pixels may have 1 to 4 bytes or be 1-bit
+ * packed (see Mono); the vector kernels are specialized for 8- and
+ * 32-bit pixels, 16- and 24-bit pixels use pshufb for magnification.
+ *
+ * For subsampling, the source may also be a level of an image pyramid
+ * (see reduce()): with a sourceShift of k, level k (whose pixels
+ * cover 2^k x 2^k original pixels) is sampled at the positions of the
+ * original pixels that would be displayed.
+ *
+ * Arbitrary zoom factors are supported via a 32.32 fixed-point source
+ * step per destination pixel (see fixedStep()), with nearest neighbor
+ * or bilinear interpolation.
+ *
+ * ImageZoom does not depend on Qt and may be used from any thread.
+ */
+class VIGRAQT_EXPORT ImageZoom
+{
+  public:
+    enum InstructionSet { Scalar, SSE2, SSSE3, AVX2 };
+
+        /**
+         * Special 'bytesPerPixel' values for 1-bit pixels, packed
+         * with the most (Mono) or least (MonoLSB) significant bit
+         * first, as in QImage::Format_Mono and Format_MonoLSB.
+         */
+    enum { Mono = -1, MonoLSB = -2 };
+
+        /**
+         * Prepare zooming of 'destWidth' destination pixels starting
+         * at source column 'left'.  'sourceWidth' is the width of the
+         * complete source rows (used to keep vector loads inside the
+         * source rows), and 'bytesPerPixel' the pixel size of both
+         * source and destination (1 to 4, Mono, or MonoLSB).  'left'
+         * is always given in original (level 0) coordinates,
+         * 'sourceWidth' is the width of pyramid level 'sourceShift'
+         * (only used for zoomLevel < 0).
+         */
+    ImageZoom(int zoomLevel, int left, int destWidth,
+              int sourceWidth, int bytesPerPixel, int sourceShift = 0);
+
+        /**
+         * Prepare resampling by an arbitrary zoom factor, given as
+         * fixed-point source 'step' per destination pixel (see
+         * fixedStep()).  Here, 'left' is the column of destination
+         * column 0 within the complete zoomed image, and the 'top'
+         * passed to zoomRows() is interpreted the same way.
+         * 'sourceWidth' and 'sourceHeight' give the size of pyramid
+         * level 'sourceShift'.  If 'bilinear' is true, the source is
+         * interpolated bilinearly (byte-wise, i.e. for 8-bit gray or
+         * for each channel of 24/32-bit color pixels; ignored for
+         * other pixel sizes).
+         */
+    ImageZoom(int64_t step, int left, int destWidth,
+              int sourceWidth, int sourceHeight, int bytesPerPixel,
+              int sourceShift, bool bilinear);
+
+        /**
+         * Return the integer zoom level (0 for arbitrary zoom factors).
+         */
+    int zoomLevel() const
+        { return zoomLevel_; }
+
+        /**
+         * Return the source row displayed in destination row y (for
+         * nearest neighbor interpolation).
+         */
+    int sourceRow(int top, int y) const
+        { return fixedStep_
+              ? (int)(((top + y) * fixedStep_ + fixedStep_ / 2)
+                      >> (32 + sourceShift_))
+              : zoomLevel_ >= 0 ? top + y / factor_
+                                : (top + y * factor_) >> sourceShift_; }
+
+        /**
+         * Return the number of bytes of a destination row.
+         */
+    int rowBytes() const
+        { return bytesPerPixel_ > 0 ? width_ * bytesPerPixel_
+                                    : (width_ + 7) / 8; }
+
+        /**
+         * Zoom one row; srcRow points to the beginning (column 0) of
+         * the source row.
+         */
+    void zoomRow(const unsigned char *srcRow, unsigned char *destRow) const
+        { rowFunction_(*this, srcRow, destRow); }
+
+        /**
+         * Zoom destination rows [beginRow, endRow) from the source
+         * image whose row 'top' corresponds to destination row 0.
+         * Destination rows showing the same source row (when
+         * magnifying) are copied instead of zoomed again.
+         */
+    void zoomRows(const unsigned char *srcBits, int srcBytesPerLine, int top,
+                  unsigned char *destBits, int destBytesPerLine,
+                  int beginRow, int endRow) const;
+
+        /**
+         * Compute the pixels [left, left+width) x [top, top+height) of
+         * the next pyramid level from the source image by averaging
+         * 2x2 blocks (byte-wise, i.e. for 8-bit gray or for each
+         * channel of 24/32-bit color pixels), or by picking the upper
+         * left pixel of each block if 'average' is false.  Blocks at
+         * odd-sized borders are completed by replicating the border.
+         */
+    static void reduce(const unsigned char *srcBits, int srcBytesPerLine,
+                       int srcWidth, int srcHeight,
+                       unsigned char *destBits, int destBytesPerLine,
+                       int left, int top, int width, int height,
+                       int bytesPerPixel, bool average);
+
+        /**
+         * Return the 32.32 fixed-point source step per destination
+         * pixel for the given zoom factor.
+         */
+    static int64_t fixedStep(double zoomFactor);
+
+        /**
+         * Return the source coordinate shown at the given coordinate
+         * of the zoomed image, i.e. floor((zoomed + 0.5) / factor)
+         * in fixed-point arithmetic (with pixel centers at +0.5).
+         */
+    static int sourceCoordinate(int64_t step, int zoomed)
+        { return (int)((zoomed * step + step / 2) >> 32); }
+
+        /**
+         * Return the first coordinate of the zoomed image showing the
+         * given source coordinate (the inverse of sourceCoordinate()).
+         */
+    static int zoomedCoordinate(int64_t step, int source);
+
+        /**
+         * Return the instruction set used for new ImageZoom objects.
+         * This defaults to supportedInstructionSet().
+         */
+    static InstructionSet instructionSet();
+
+        /**
+         * Return the best instruction set supported by the CPU.
+         */
+    static InstructionSet supportedInstructionSet();
+
+        /**
+         * Restrict the kernels to the given instruction set (useful
+         * for testing and benchmarking).  Instruction sets not
+         * supported by the CPU are replaced by the best supported one.
+         */
+    static void setInstructionSet(InstructionSet is);
+
+  private:
+    friend struct ImageZoomKernels;
+
+    typedef void (*RowFunction)(const ImageZoom &,
+                                const unsigned char *, unsigned char *);
+    typedef void (*BlendFunction)(const unsigned char *, const unsigned char *,
+                                  int, unsigned char *, int);
+
+    void chooseRowFunction();
+    void chooseInterpolationFunctions();
+    void computeShuffleMasks(int sourceWidth);
+    void zoomRowsBilinear(const unsigned char *srcBits, int srcBytesPerLine,
+                          int top, unsigned char *destBits,
+                          int destBytesPerLine, int beginRow, int endRow) const;
+
+    int zoomLevel_, factor_, width_, sourceWidth_, bytesPerPixel_;
+    int sourceShift_;
+
+        // fixed-point source step for arbitrary zoom factors (or 0):
+    int64_t fixedStep_;
+    int sourceHeight_;
+    bool bilinear_;
+
+        // source column for each destination column (for bilinear
+        // interpolation: the left one of both, relative to spanBegin_):
+    std::vector<int> index_;
+
+        // weights of the right source columns and range of source
+        // columns needed (only used for bilinear interpolation):
+    std::vector<unsigned char> weights_;
+    int spanBegin_, spanEnd_;
+
+        // constant distance of subsampled source columns (or 0):
+    int step_;
+
+        // pshufb masks for the first vectorChunks_ 16-byte chunks of
+        // the destination row (only used by magnifying SSSE3 kernels):
+    std::vector<unsigned char> shuffleMasks_;
+    int vectorChunks_;
+
+    RowFunction rowFunction_;
+    BlendFunction blendFunction_;
+};
+
+#endif // IMAGEZOOM_HXX
@@ -38,14 +38,24 @@ struct OverlayZCompare
     }
 };
 
+void OverlayViewer::sortOverlays(Overlays &overlays)
+{
+    std::stable_sort(overlays.begin(), overlays.end(), OverlayZCompare());
+}
+
 void OverlayViewer::paintOverlays(QPainter &p, const QRect &r)
 {
-    std::stable_sort(overlays_.begin(), overlays_.end(),
-                     OverlayZCompare());
+    sortOverlays(overlays_);
+
+    drawOverlays(p, r, overlays_, upperLeft_, zoomFactor());
+}
 
+void OverlayViewer::drawOverlays(QPainter &p, const QRect &r,
+                                 const Overlays &overlays,
+                                 const QPoint &upperLeft, qreal scale)
+{
     p.save();
-    qreal scale = zoomFactor();
-    foreach(Overlay *overlay, overlays_)
+    foreach(Overlay *overlay, overlays)
     {
         if(!overlay->isVisible())
             continue;
@@ -54,7 +64,7 @@ void OverlayViewer::paintOverlays(QPainter &p, const QRect &r)
         p.setRenderHint(QPainter::Antialiasing, overlay->isAntialiased());
         if(overlay->coordinateSystem() != Overlay::Widget)
         {
-            p.translate(upperLeft_.x(), upperLeft_.y());
+            p.translate(upperLeft.x(), upperLeft.y());
             if(overlay->coordinateSystem() & Overlay::Scaled)
                 p.scale(scale, scale);
             if(overlay->coordinateSystem() & Overlay::Pixel)
@@ -66,18 +76,36 @@ void OverlayViewer::paintOverlays(QPainter &p, const QRect &r)
     p.restore();
 }
 
+void OverlayViewer::scrollImage(QPoint const &offset)
+{
+    // overlays in widget coordinates do not move with the image:
+    foreach(Overlay *overlay, overlays_)
+    {
+        if(overlay->isVisible() &&
+           overlay->coordinateSystem() == Overlay::Widget)
+        {
+            update();
+            return;
+        }
+    }
+
+    QImageViewer::scrollImage(offset);
+}
+
 void OverlayViewer::paintEvent(QPaintEvent *e)
 {
     if(!isVisible())
         return;
 
-    QRect r = e->rect();
+    RenderTimer paintTimer(renderStat(&QImageViewerRenderStats::paintTime));
 
     QPainter p;
     p.begin(this);
 
-    p.save();
+    foreach(QRect const &r, paintRects(e))
     {
+        p.save();
+
         // we don't want to paint into the frame, but contentsRect()
         // is too small for some widget styles with round corners
         // and/or shadows (e.g. Oxygen):
@@ -87,13 +115,22 @@ void OverlayViewer::paintEvent(QPaintEvent *e)
 
         p.fillRect(r, palette().brush(backgroundRole()));
         paintImage(p, r);
-        paintOverlays(p, r);
+
+        {
+            RenderTimer overlayTimer(
+                renderStat(&QImageViewerRenderStats::overlayTime));
+            paintOverlays(p, r);
+        }
+
+        p.restore();
     }
-    p.restore();
 
     drawFrame(&p);
 
     p.end();
+
+    paintTimer.stop();
+    paintFinished();
 }
 
 /********************************************************************/
@@ -152,6 +189,11 @@ qreal Overlay::zValue() const
     return z_;
 }
 
+OverlayViewer *Overlay::viewer() const
+{
+    return viewer_;
+}
+
 void Overlay::setZValue(qreal z)
 {
     if(z != z_)
@@ -27,8 +27,26 @@ class VIGRAQT_EXPORT OverlayViewer : public QImageViewer
     Overlays overlays() const
     {return overlays_;}
 
+        /**
+         * Draw the visible overlays (in the given order, see
+         * sortOverlays()) for an image whose origin is at upperLeft
+         * and which is zoomed by scale.  r is the window rect to be
+         * updated, as for Overlay::draw().  Used by paintOverlays()
+         * and QImageViewRenderer.
+         */
+    static void drawOverlays(QPainter &p, const QRect &r,
+                             const Overlays &overlays,
+                             const QPoint &upperLeft, qreal scale);
+
+        /**
+         * Sort overlays by their zValue() (keeping the order of
+         * overlays with equal zValue()).
+         */
+    static void sortOverlays(Overlays &overlays);
+
   protected:
     virtual void paintOverlays(QPainter &p, const QRect &r);
+    virtual void scrollImage(QPoint const &offset);
     virtual void paintEvent(QPaintEvent *e);
 
     Overlays overlays_;
@@ -84,6 +102,12 @@ class VIGRAQT_EXPORT Overlay : public QObject
     qreal zValue() const;
     void setZValue(qreal z);
 
+        /**
+         * Return the OverlayViewer the overlay has been added to, or
+         * 0.
+         */
+    OverlayViewer *viewer() const;
+
   public Q_SLOTS:
     virtual void setZoomLevel(int);
 
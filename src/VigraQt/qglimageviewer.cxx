@@ -238,11 +238,11 @@ void QGLImageViewer::setImage(QImage const &image, bool retainView)
         glWidget_->setImage(originalImage_);
 }
 
-void QGLImageViewer::updateROI(QImage const &roiImage, QPoint const &upperLeft)
+void QGLImageViewer::markDirty(QRect const &roi)
 {
-    QImageViewerBase::updateROI(roiImage, upperLeft);
+    QImageViewerBase::markDirty(roi);
     if(ensureGLWidget())
-        glWidget_->roiChanged(upperLeft, roiImage.size());
+        glWidget_->roiChanged(roi.topLeft(), roi.size());
 }
 
 void QGLImageViewer::slideBy(QPoint const &diff)
@@ -13,7 +13,7 @@ public:
     QGLImageViewer(QWidget *parent = 0);
 
     virtual void setImage(QImage const &image, bool retainView= false);
-    virtual void updateROI(QImage const &roiImage, QPoint const &upperLeft);
+    virtual void markDirty(QRect const &roi);
 
     virtual void slideBy(QPoint const &diff);
 
@@ -0,0 +1,111 @@
+#include "qimagebufferpool.hxx"
+#include <QMutexLocker>
+
+Q_GLOBAL_STATIC(QImageBufferPool, globalBufferPool)
+
+QImageBufferPool::QImageBufferPool(int maxSize)
+: size_(0),
+  maxSize_((qint64)maxSize * 1024),
+  allocatedBytes_(0),
+  reusedBytes_(0)
+{
+}
+
+QImageBufferPool *QImageBufferPool::globalInstance()
+{
+    return globalBufferPool();
+}
+
+QImage QImageBufferPool::image(QSize const &size, QImage::Format format,
+                               QVector<QRgb> const &colorTable)
+{
+    QImage result;
+    {
+        QMutexLocker locker(&mutex_);
+        // search the most recently recycled buffers (whose pages are
+        // most likely still resident) first:
+        for(int i = images_.size() - 1; i >= 0; --i)
+        {
+            if(images_[i].size() == size && images_[i].format() == format)
+            {
+                result = images_.takeAt(i);
+                size_ -= result.byteCount();
+                reusedBytes_ += result.byteCount();
+                break;
+            }
+        }
+    }
+
+    if(result.isNull())
+    {
+        result = QImage(size, format);
+        if(result.isNull())
+            return result;
+
+        QMutexLocker locker(&mutex_);
+        allocatedBytes_ += result.byteCount();
+    }
+
+    if(result.colorTable() != colorTable)
+        result.setColorTable(colorTable);
+    return result;
+}
+
+void QImageBufferPool::recycle(QImage &image)
+{
+    if(!image.isNull())
+    {
+        QMutexLocker locker(&mutex_);
+        if(image.byteCount() <= maxSize_)
+        {
+            images_.append(image);
+            size_ += image.byteCount();
+            trim();
+        }
+    }
+    image = QImage();
+}
+
+int QImageBufferPool::maxSize() const
+{
+    QMutexLocker locker(&mutex_);
+    return (int)(maxSize_ / 1024);
+}
+
+void QImageBufferPool::setMaxSize(int kiloBytes)
+{
+    QMutexLocker locker(&mutex_);
+    maxSize_ = (qint64)qMax(0, kiloBytes) * 1024;
+    trim();
+}
+
+int QImageBufferPool::size() const
+{
+    QMutexLocker locker(&mutex_);
+    return (int)(size_ / 1024);
+}
+
+void QImageBufferPool::clear()
+{
+    QMutexLocker locker(&mutex_);
+    images_.clear();
+    size_ = 0;
+}
+
+qint64 QImageBufferPool::allocatedBytes() const
+{
+    QMutexLocker locker(&mutex_);
+    return allocatedBytes_;
+}
+
+qint64 QImageBufferPool::reusedBytes() const
+{
+    QMutexLocker locker(&mutex_);
+    return reusedBytes_;
+}
+
+void QImageBufferPool::trim()
+{
+    while(size_ > maxSize_ && !images_.isEmpty())
+        size_ -= images_.takeFirst().byteCount();
+}
@@ -0,0 +1,94 @@
+#ifndef QIMAGEBUFFERPOOL_HXX
+#define QIMAGEBUFFERPOOL_HXX
+
+#include "vigraqt_export.hxx"
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSize>
+#include <QVector>
+
+/**
+ * Pool of image buffers that are reused for new images of the same
+ * size and format instead of being allocated (and faulted in) again.
+ * QImageViewer takes the destination images of zooming from
+ * globalInstance() and returns them after they have been uploaded
+ * into tile pixmaps, so that interactive zooming and ROI updates
+ * mostly recycle the same few buffers.
+ *
+ * All functions are thread-safe.  Since QImages are implicitly
+ * shared, recycling an image that is still referenced elsewhere is
+ * safe, too: the pool's copy is only detached (i.e. allocated anew)
+ * when it is written to next.  However, images wrapping external
+ * buffers (see QImageViewerBase::setImageData()) must not be
+ * recycled, since they do not own their pixels.
+ */
+class VIGRAQT_EXPORT QImageBufferPool
+{
+  public:
+        /**
+         * Create a pool holding up to maxSize kilobytes of unused
+         * buffers.
+         */
+    QImageBufferPool(int maxSize = 16*1024);
+
+        /**
+         * Return the pool shared by all viewers.
+         */
+    static QImageBufferPool *globalInstance();
+
+        /**
+         * Return an image with the given size, format, and color
+         * table, whose buffer is taken from the pool if possible.
+         * The pixels are not initialized.
+         */
+    QImage image(QSize const &size, QImage::Format format,
+                 QVector<QRgb> const &colorTable = QVector<QRgb>());
+
+        /**
+         * Return image's buffer to the pool (if it fits into
+         * maxSize(), dropping the least recently recycled buffers
+         * otherwise) and set image to a null image.
+         */
+    void recycle(QImage &image);
+
+        /**
+         * Return the maximum size of the unused buffers in kilobytes.
+         */
+    int maxSize() const;
+
+        /**
+         * Set the maximum size of the unused buffers in kilobytes
+         * (default: 16MB); 0 disables pooling.
+         */
+    void setMaxSize(int kiloBytes);
+
+        /**
+         * Return the size of the unused buffers in kilobytes.
+         */
+    int size() const;
+
+        /**
+         * Free all unused buffers.
+         */
+    void clear();
+
+        /**
+         * Return the number of bytes allocated resp. reused by
+         * image() so far.
+         */
+    qint64 allocatedBytes() const;
+    qint64 reusedBytes() const;
+
+  private:
+        // drop the oldest buffers until size_ <= maxSize_ (with
+        // mutex_ locked)
+    void trim();
+
+    mutable QMutex mutex_;
+    QList<QImage> images_; // least recently recycled first
+    qint64 size_, maxSize_; // in bytes
+    qint64 allocatedBytes_, reusedBytes_;
+};
+
+#endif // QIMAGEBUFFERPOOL_HXX
@@ -0,0 +1,77 @@
+#include "qimageformattraits.hxx"
+#include "imagezoom.hxx"
+#include <algorithm>
+#include <string.h>
+
+// indexed by QImage::Format:
+static const QImageFormatTraits formatTraits_[] = {
+    { QImage::Format_Invalid,                 0, 0,                  false },
+    { QImage::Format_Mono,                    1, ImageZoom::Mono,    false },
+    { QImage::Format_MonoLSB,                 1, ImageZoom::MonoLSB, false },
+    { QImage::Format_Indexed8,                8, 1,                  true  },
+    { QImage::Format_RGB32,                  32, 4,                  true  },
+    { QImage::Format_ARGB32,                 32, 4,                  true  },
+    { QImage::Format_ARGB32_Premultiplied,   32, 4,                  true  },
+    { QImage::Format_RGB16,                  16, 2,                  false },
+    { QImage::Format_ARGB8565_Premultiplied, 24, 3,                  false },
+    { QImage::Format_RGB666,                 24, 3,                  false },
+    { QImage::Format_ARGB6666_Premultiplied, 24, 3,                  false },
+    { QImage::Format_RGB555,                 16, 2,                  false },
+    { QImage::Format_ARGB8555_Premultiplied, 24, 3,                  false },
+    { QImage::Format_RGB888,                 24, 3,                  true  },
+    { QImage::Format_RGB444,                 16, 2,                  false },
+    { QImage::Format_ARGB4444_Premultiplied, 16, 2,                  false },
+};
+
+const QImageFormatTraits &QImageFormatTraits::of(QImage::Format format)
+{
+    int count = sizeof(formatTraits_) / sizeof(formatTraits_[0]);
+    if(format < 0 || format >= count)
+        return formatTraits_[0];
+    return formatTraits_[format];
+}
+
+// copy 1-bit pixels one by one
+static void copyBits(const uchar *src, int srcX, uchar *dest, int destX,
+                     int count, bool lsb)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        int s = srcX + i, d = destX + i;
+        int sMask = lsb ? 1 << (s & 7) : 0x80 >> (s & 7);
+        int dMask = lsb ? 1 << (d & 7) : 0x80 >> (d & 7);
+        if(src[s >> 3] & sMask)
+            dest[d >> 3] |= dMask;
+        else
+            dest[d >> 3] &= ~dMask;
+    }
+}
+
+void QImageFormatTraits::copyPixels(const uchar *src, int srcX,
+                                    uchar *dest, int destX, int count) const
+{
+    if(bitsPerPixel >= 8)
+    {
+        int bpp = bytesPerPixel();
+        memcpy(dest + destX * bpp, src + srcX * bpp, count * bpp);
+        return;
+    }
+
+    if(bitsPerPixel != 1 || count <= 0)
+        return;
+
+    bool lsb = zoomPixelSize == ImageZoom::MonoLSB;
+    if((srcX & 7) != (destX & 7))
+    {
+        copyBits(src, srcX, dest, destX, count, lsb);
+        return;
+    }
+
+    // both rows are aligned alike, so whole bytes can be copied
+    // between the partial first and last bytes:
+    int lead = std::min(count, (8 - (srcX & 7)) & 7);
+    int bytes = (count - lead) / 8, done = lead + 8 * bytes;
+    copyBits(src, srcX, dest, destX, lead, lsb);
+    memcpy(dest + (destX + lead) / 8, src + (srcX + lead) / 8, bytes);
+    copyBits(src, srcX + done, dest, destX + done, count - done, lsb);
+}
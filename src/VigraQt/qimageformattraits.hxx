@@ -0,0 +1,65 @@
+#ifndef QIMAGEFORMATTRAITS_HXX
+#define QIMAGEFORMATTRAITS_HXX
+
+#include "vigraqt_export.hxx"
+#include <QImage>
+
+/**
+ * Pixel layout of a QImage::Format, as needed for zooming and
+ * copying raw image data.  QImageViewer dispatches its zoom and ROI
+ * copy kernels through the table behind of(), so that images can be
+ * displayed in their native format (e.g. 1-bit masks, RGB565, or
+ * RGB888) instead of being converted to 32 bits first.
+ */
+struct VIGRAQT_EXPORT QImageFormatTraits
+{
+    QImage::Format format;
+
+        // size of a pixel in bits (1, 8, 16, 24, or 32), or 0 for
+        // Format_Invalid and unknown formats
+    int bitsPerPixel;
+
+        // pixel size to be passed to ImageZoom (bytes per pixel, or
+        // ImageZoom::Mono/MonoLSB for the 1-bit formats)
+    int zoomPixelSize;
+
+        // whether all channels are whole bytes, i.e. whether pixels
+        // may be averaged or interpolated byte-wise
+    bool byteChannels;
+
+        /**
+         * Return the traits of the given format.
+         */
+    static const QImageFormatTraits &of(QImage::Format format);
+
+        /**
+         * Returns whether QImageViewer can zoom images of this format
+         * (other formats are converted by setImage()).
+         */
+    bool isSupported() const
+        { return bitsPerPixel != 0; }
+
+        /**
+         * Return the bytes per pixel (0 for the 1-bit formats).
+         */
+    int bytesPerPixel() const
+        { return bitsPerPixel / 8; }
+
+        /**
+         * Returns whether the pixels of image (which must have this
+         * format) may be interpolated byte-wise; indexed images need
+         * a gray color table.
+         */
+    bool canInterpolate(QImage const &image) const
+        { return byteChannels && (bitsPerPixel != 8 || image.isGrayscale()); }
+
+        /**
+         * Copy count pixels from column srcX of the row src to column
+         * destX of the row dest (which need not be byte-aligned for
+         * the 1-bit formats).
+         */
+    void copyPixels(const uchar *src, int srcX, uchar *dest, int destX,
+                    int count) const;
+};
+
+#endif // QIMAGEFORMATTRAITS_HXX
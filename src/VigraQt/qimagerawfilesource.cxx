@@ -0,0 +1,205 @@
+#include "qimagerawfilesource.hxx"
+#include "qimageformattraits.hxx"
+#include <QList>
+
+static const char rawFileMagic[] = "VIGRAQT_RAW 1";
+
+QImageRawFileSource::QImageRawFileSource(
+    QString const &fileName, QSize const &size, QImage::Format format,
+    int bytesPerLine, qint64 offset, QVector<QRgb> const &colorTable)
+: file_(fileName),
+  size_(size),
+  format_(format),
+  bytesPerLine_(bytesPerLine),
+  colorTable_(colorTable),
+  data_(0)
+{
+    open(offset);
+}
+
+QImageRawFileSource::QImageRawFileSource(QString const &fileName)
+: file_(fileName),
+  format_(QImage::Format_Invalid),
+  bytesPerLine_(0),
+  data_(0)
+{
+    if(readHeader())
+        open(HeaderSize);
+}
+
+QImageRawFileSource::~QImageRawFileSource()
+{
+    if(data_)
+        file_.unmap(data_);
+}
+
+bool QImageRawFileSource::readHeader()
+{
+    if(!file_.isOpen() && !file_.open(QIODevice::ReadOnly))
+    {
+        errorString_ = file_.errorString();
+        return false;
+    }
+
+    QByteArray header(file_.read(HeaderSize));
+    if(header.indexOf('\0') >= 0)
+        header.truncate(header.indexOf('\0'));
+    QList<QByteArray> lines(header.split('\n'));
+    if(lines.isEmpty() || lines[0] != rawFileMagic)
+    {
+        errorString_ = "not a VigraQt raw image file";
+        return false;
+    }
+
+    for(int i = 1; i < lines.size(); ++i)
+    {
+        QList<QByteArray> fields(lines[i].split(' '));
+        if(fields[0] == "size" && fields.size() == 3)
+            size_ = QSize(fields[1].toInt(), fields[2].toInt());
+        else if(fields[0] == "format" && fields.size() == 2)
+            format_ = (QImage::Format)fields[1].toInt();
+        else if(fields[0] == "bytesPerLine" && fields.size() == 2)
+            bytesPerLine_ = fields[1].toInt();
+        else if(fields[0] == "colors" && fields.size() >= 2)
+            for(int c = 2; c < fields.size(); ++c)
+                colorTable_.append(fields[c].toUInt(0, 16));
+    }
+    return true;
+}
+
+void QImageRawFileSource::open(qint64 offset)
+{
+    const QImageFormatTraits &traits(QImageFormatTraits::of(format_));
+    if(!traits.isSupported() || size_.isEmpty())
+    {
+        errorString_ = "invalid image size or format";
+        return;
+    }
+
+    int rowBytes = (size_.width() * traits.bitsPerPixel + 7) / 8;
+    if(!bytesPerLine_)
+        bytesPerLine_ = rowBytes;
+    if(bytesPerLine_ < rowBytes)
+    {
+        errorString_ = "bytesPerLine too small for image width";
+        return;
+    }
+
+    if(!file_.isOpen() && !file_.open(QIODevice::ReadOnly))
+    {
+        errorString_ = file_.errorString();
+        return;
+    }
+
+    qint64 dataSize = (qint64)bytesPerLine_ * (size_.height() - 1) + rowBytes;
+    if(file_.size() < offset + dataSize)
+    {
+        errorString_ = "file too small for the given image size";
+        return;
+    }
+
+    data_ = file_.map(offset, dataSize);
+    if(!data_)
+    {
+        errorString_ = file_.errorString();
+        return;
+    }
+    // (the mapping stays valid after closing the file)
+    file_.close();
+
+    if(format_ == QImage::Format_Indexed8 && colorTable_.isEmpty())
+        for(int i = 0; i < 256; ++i)
+            colorTable_.append(qRgb(i, i, i));
+}
+
+QSize QImageRawFileSource::size() const
+{
+    return size_;
+}
+
+QImage::Format QImageRawFileSource::format() const
+{
+    return format_;
+}
+
+QVector<QRgb> QImageRawFileSource::colorTable() const
+{
+    return colorTable_;
+}
+
+QImage QImageRawFileSource::region(QRect const &roi, int level) const
+{
+    QRect r(roi & QRect(QPoint(0, 0), size_));
+    if(!data_ || level != 0 || r.isEmpty())
+        return QImage();
+
+    const uchar *firstRow = data_ + (qint64)r.top() * bytesPerLine_;
+    const QImageFormatTraits &traits(QImageFormatTraits::of(format_));
+    const uchar *firstPixel = firstRow + r.left() * traits.bytesPerPixel();
+    QImage result;
+    if(traits.bitsPerPixel < 8 ||
+       ((quintptr)firstPixel & 3) || (bytesPerLine_ & 3))
+    {
+        // 1-bit rows can only be referenced from byte boundaries, and
+        // QImage requires 32-bit aligned scanlines (which headerless
+        // dumps with odd offsets or row lengths do not have):
+        result = QImage(r.size(), format_);
+        for(int y = 0; y < r.height(); ++y)
+            traits.copyPixels(firstRow + (qint64)y * bytesPerLine_, r.left(),
+                              result.scanLine(y), 0, r.width());
+    }
+    else
+    {
+        // reference the mapped pixels (faulting in only the pages
+        // actually read); QImage would copy read-only data in
+        // setColorTable(), and the viewer only reads the result:
+        result = QImage(const_cast<uchar *>(firstPixel),
+                        r.width(), r.height(), bytesPerLine_, format_);
+    }
+    if(!colorTable_.isEmpty())
+        result.setColorTable(colorTable_);
+    return result;
+}
+
+bool QImageRawFileSource::writeHeader(QIODevice &device, QSize const &size,
+                                      QImage::Format format, int bytesPerLine,
+                                      QVector<QRgb> const &colorTable)
+{
+    QByteArray header(rawFileMagic);
+    header += "\nsize " + QByteArray::number(size.width())
+        + " " + QByteArray::number(size.height());
+    header += "\nformat " + QByteArray::number((int)format);
+    header += "\nbytesPerLine " + QByteArray::number(bytesPerLine);
+    if(!colorTable.isEmpty())
+    {
+        header += "\ncolors " + QByteArray::number(colorTable.size());
+        foreach(QRgb color, colorTable)
+            header += " " + QByteArray::number(color, 16);
+    }
+    header += "\n";
+
+    if(header.size() > HeaderSize)
+        return false;
+    header.append(QByteArray(HeaderSize - header.size(), '\0'));
+    return device.write(header) == HeaderSize;
+}
+
+bool QImageRawFileSource::save(QImage const &image, QString const &fileName)
+{
+    if(image.isNull())
+        return false;
+
+    const QImage data(QImageFormatTraits::of(image.format()).isSupported()
+                      ? image
+                      : image.convertToFormat(
+                          QImage::Format_ARGB32_Premultiplied));
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly) ||
+       !writeHeader(file, data.size(), data.format(), data.bytesPerLine(),
+                    data.colorTable()))
+        return false;
+
+    qint64 dataSize = (qint64)data.bytesPerLine() * data.height();
+    return file.write((const char *)data.bits(), dataSize) == dataSize;
+}
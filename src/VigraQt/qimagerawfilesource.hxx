@@ -0,0 +1,102 @@
+#ifndef QIMAGERAWFILESOURCE_HXX
+#define QIMAGERAWFILESOURCE_HXX
+
+#include "qimagetilesource.hxx"
+#include <QFile>
+#include <QString>
+
+/**
+ * QImageTileSource serving the pixels of a raw image file, which is
+ * memory-mapped instead of being read.  Thus, opening even huge
+ * files is immediate, only the pages of the regions actually
+ * displayed are read (by the OS, on first access), and the OS page
+ * cache is shared between all viewers displaying the same file.
+ *
+ * Two kinds of files are supported:
+ *
+ * - headerless raw dumps, whose size, format, and layout have to be
+ *   passed to the constructor, and
+ *
+ * - files with a small text header describing the image (see
+ *   writeHeader() and save()), which is padded to HeaderSize bytes.
+ *
+ * The images returned by region() reference the mapped file and must
+ * not be used after the source has been destroyed.  (Regions of 1-bit
+ * images, and of files whose rows are not 32-bit aligned as required
+ * by QImage, are copied instead.)  Since the whole file is mapped at
+ * once, files larger than the address space (i.e. more than about
+ * 2 GB on 32-bit systems) cannot be opened.
+ */
+class VIGRAQT_EXPORT QImageRawFileSource : public QImageTileSource
+{
+  public:
+    enum { HeaderSize = 4096 };
+
+        /**
+         * Open the headerless raw file fileName, whose pixel data
+         * (in the given format, with rows of bytesPerLine bytes)
+         * starts at the given offset.  bytesPerLine = 0 means that
+         * rows are not padded.  8-bit files (Format_Indexed8) are
+         * displayed as gray images unless a colorTable is given.
+         * Check isValid() afterwards.
+         */
+    QImageRawFileSource(QString const &fileName, QSize const &size,
+                        QImage::Format format, int bytesPerLine = 0,
+                        qint64 offset = 0,
+                        QVector<QRgb> const &colorTable = QVector<QRgb>());
+
+        /**
+         * Open fileName, which must start with a header written by
+         * writeHeader().  Check isValid() afterwards.
+         */
+    QImageRawFileSource(QString const &fileName);
+
+    virtual ~QImageRawFileSource();
+
+        /**
+         * Returns whether the file could be opened and mapped.
+         */
+    bool isValid() const
+        { return data_ != 0; }
+
+        /**
+         * Return a description of the last error (if !isValid()).
+         */
+    QString errorString() const
+        { return errorString_; }
+
+    virtual QSize size() const;
+    virtual QImage::Format format() const;
+    virtual QVector<QRgb> colorTable() const;
+    virtual QImage region(QRect const &roi, int level = 0) const;
+
+        /**
+         * Write a header describing an image with the given
+         * properties to device, padded to HeaderSize bytes.  The
+         * pixel data (rows of bytesPerLine bytes) has to follow
+         * immediately.
+         */
+    static bool writeHeader(QIODevice &device, QSize const &size,
+                            QImage::Format format, int bytesPerLine,
+                            QVector<QRgb> const &colorTable = QVector<QRgb>());
+
+        /**
+         * Save image to fileName with a header, so that it can be
+         * opened by QImageRawFileSource(fileName).
+         */
+    static bool save(QImage const &image, QString const &fileName);
+
+  private:
+    void open(qint64 offset);
+    bool readHeader();
+
+    QFile file_;
+    QSize size_;
+    QImage::Format format_;
+    int bytesPerLine_;
+    QVector<QRgb> colorTable_;
+    uchar *data_;
+    QString errorString_;
+};
+
+#endif // QIMAGERAWFILESOURCE_HXX
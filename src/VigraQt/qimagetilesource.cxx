@@ -0,0 +1,71 @@
+#include "qimagetilesource.hxx"
+#include "qimageformattraits.hxx"
+
+QImageTileSource::~QImageTileSource()
+{
+}
+
+QVector<QRgb> QImageTileSource::colorTable() const
+{
+    return QVector<QRgb>();
+}
+
+int QImageTileSource::levelCount() const
+{
+    return 0;
+}
+
+QSize QImageTileSource::levelSize(int level) const
+{
+    QSize s(size());
+    int mask = (1 << level) - 1;
+    return QSize((s.width() + mask) >> level, (s.height() + mask) >> level);
+}
+
+/********************************************************************/
+
+QImageMemoryTileSource::QImageMemoryTileSource(QImage const &image)
+: image_(QImageFormatTraits::of(image.format()).isSupported()
+         ? image
+         : image.convertToFormat(QImage::Format_ARGB32_Premultiplied))
+{
+}
+
+QSize QImageMemoryTileSource::size() const
+{
+    return image_.size();
+}
+
+QImage::Format QImageMemoryTileSource::format() const
+{
+    return image_.format();
+}
+
+QVector<QRgb> QImageMemoryTileSource::colorTable() const
+{
+    return image_.colorTable();
+}
+
+QImage QImageMemoryTileSource::region(QRect const &roi, int level) const
+{
+    QRect r(roi & image_.rect());
+    if(level != 0 || r.isEmpty())
+        return QImage();
+
+    // 1-bit rows can only be referenced from byte boundaries:
+    const QImageFormatTraits &traits(QImageFormatTraits::of(image_.format()));
+    if(traits.bitsPerPixel < 8)
+        return image_.copy(r);
+
+    // reference the pixels instead of copying them (the const bits()
+    // does not detach image_; QImage would copy read-only data in
+    // setColorTable(), and the viewer only reads the result):
+    QImage result(const_cast<uchar *>(image_.bits())
+                  + r.top() * image_.bytesPerLine()
+                  + r.left() * traits.bytesPerPixel(),
+                  r.width(), r.height(), image_.bytesPerLine(),
+                  image_.format());
+    if(!image_.colorTable().isEmpty())
+        result.setColorTable(image_.colorTable());
+    return result;
+}
@@ -0,0 +1,86 @@
+#ifndef QIMAGETILESOURCE_HXX
+#define QIMAGETILESOURCE_HXX
+
+#include "vigraqt_export.hxx"
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+
+/**
+ * Provider of the image data displayed by QImageViewer::setTileSource(),
+ * for images that should not (or cannot) be held in one QImage, e.g.
+ * gigapixel scans read from disk on demand.
+ *
+ * The viewer pulls the regions needed for its tiles via region(),
+ * which is called from background threads and must therefore be
+ * reentrant.  Sources may provide reduced levels of the image (each
+ * half the size of the previous one, like QImageViewerBase's image
+ * pyramid), which are then used for negative zoom levels.
+ */
+class VIGRAQT_EXPORT QImageTileSource
+{
+  public:
+    virtual ~QImageTileSource();
+
+        /**
+         * Return the size of the complete image (level 0).
+         */
+    virtual QSize size() const = 0;
+
+        /**
+         * Return the format of the images returned by region() (which
+         * must be supported by QImageFormatTraits).
+         */
+    virtual QImage::Format format() const = 0;
+
+        /**
+         * Return the color table of indexed images (default: empty).
+         */
+    virtual QVector<QRgb> colorTable() const;
+
+        /**
+         * Return the number of reduced levels available (default:
+         * 0).  Level k has the size levelSize(k), i.e. its pixels
+         * cover 2^k x 2^k pixels of level 0.
+         */
+    virtual int levelCount() const;
+
+        /**
+         * Return the given ROI (in coordinates of the given level,
+         * within levelSize(level)) as an image of format().  The
+         * returned image may share data with the source (as long as
+         * the source exists).  Called from worker threads.
+         */
+    virtual QImage region(QRect const &roi, int level = 0) const = 0;
+
+        /**
+         * Return the size of the given level, i.e. size() divided by
+         * 2^level and rounded up.
+         */
+    QSize levelSize(int level) const;
+};
+
+/**
+ * QImageTileSource serving the pixels of an in-memory QImage (without
+ * reduced levels).  region() returns images referencing the data of
+ * image() where possible, so that no pixels are copied.
+ */
+class VIGRAQT_EXPORT QImageMemoryTileSource : public QImageTileSource
+{
+  public:
+    QImageMemoryTileSource(QImage const &image);
+
+    const QImage &image() const
+        { return image_; }
+
+    virtual QSize size() const;
+    virtual QImage::Format format() const;
+    virtual QVector<QRgb> colorTable() const;
+    virtual QImage region(QRect const &roi, int level = 0) const;
+
+  private:
+    QImage image_;
+};
+
+#endif // QIMAGETILESOURCE_HXX
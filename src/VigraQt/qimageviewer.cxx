@@ -24,6 +24,11 @@
 /************************************************************************/
 
 #include "qimageviewer.hxx"
+#include "imagezoom.hxx"
+#include "qimagebufferpool.hxx"
+#include "qimageformattraits.hxx"
+#include "qimagetilesource.hxx"
+#include "qimageviewergroup.hxx"
 #include <QBitmap>
 #include <QCursor>
 #include <QApplication>
@@ -32,6 +37,14 @@
 #include <QPixmap>
 #include <QMouseEvent>
 #include <QKeyEvent>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QReadWriteLock>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QtDebug>
 #include <cmath>
 #include <algorithm>
 
@@ -43,15 +56,29 @@
 
 QImageViewerBase::QImageViewerBase(QWidget *parent)
 : QFrame(parent),
+  imageSize_(0, 0),
+  externalImageData_(false),
   upperLeft_(0, 0),
   zoomLevel_(0),
+  zoomFactor_(1.0),
+  zoomStep_(0),
+  fractionalZoomEnabled_(false),
+  pyramidEnabled_(false),
   inSlideState_(false),
-  pendingAutoZoom_(false)
+  pendingAutoZoom_(false),
+  updateTimer_(new QTimer(this)),
+  maxUpdateRate_(60),
+  mergedUpdateCount_(0),
+  droppedUpdateCount_(0),
+  group_(0)
 {
     setMouseTracking(true);
     setSizePolicy(QSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding));
     setFocusPolicy(Qt::StrongFocus);
     setCrosshairCursor();
+
+    updateTimer_->setSingleShot(true);
+    connect(updateTimer_, SIGNAL(timeout()), SLOT(flushDirty()));
 }
 
 /****************************************************************/
@@ -62,31 +89,89 @@ QImageViewerBase::QImageViewerBase(QWidget *parent)
 
 void QImageViewerBase::setImage(QImage const &image, bool retainView)
 {
-    QSize sizeDiff = image.size() - originalImage_.size();
+    {
+        QWriteLocker locker(imageLock());
+
+        // (all formats of Qt 4 are supported natively)
+        if(image.isNull() ||
+           QImageFormatTraits::of(image.format()).isSupported())
+            originalImage_ = image;
+        else
+            originalImage_ = image.convertToFormat(
+                QImage::Format_ARGB32_Premultiplied);
+        externalImageData_ = false;
+        buildPyramid();
+    }
+
+    // queued updates are superseded by the new image:
+    dropQueuedUpdates();
+
+    setImageSize(originalImage_.size(), retainView);
+
+    emit imageChanged();
+}
+
+void QImageViewerBase::setImageSize(QSize const &size, bool retainView)
+{
+    QSize sizeDiff = size - imageSize_;
     QPointF offset(sizeDiff.width() / 2.0,
                    sizeDiff.height() / 2.0);
-
-    originalImage_ = image;
+    imageSize_ = size;
 
     if(sizeDiff.isNull() || retainView)
     {
         setImagePosition(
-            upperLeft_ - zoomF(offset, zoomLevel_).toPoint(),
+            upperLeft_ - toZoomedF(offset).toPoint(),
             centerPixel_ + offset);
     }
     else
     {
         // reset zoom level and center visible region
         zoomLevel_ = 0;
-        setCenterPixel(QPointF(image.width() / 2.0,
-                               image.height() / 2.0));
+        zoomFactor_ = 1.0;
+        zoomStep_ = 0;
+        setCenterPixel(QPointF(size.width() / 2.0,
+                               size.height() / 2.0));
 
         updateGeometry();
 
 	emit zoomLevelChanged(zoomLevel_);
+	emit zoomFactorChanged(zoomFactor_);
     }
+}
 
-    emit imageChanged();
+/****************************************************************/
+/*                                                              */
+/*                          setImageData                        */
+/*                                                              */
+/****************************************************************/
+
+void QImageViewerBase::setImageData(uchar *data, QSize const &size,
+                                    int bytesPerLine, QImage::Format format,
+                                    QVector<QRgb> const &colorTable,
+                                    bool retainView)
+{
+    // this QImage only references data (setting the color table does
+    // not detach it, since it is not shared yet):
+    QImage image(data, size.width(), size.height(), bytesPerLine, format);
+    if(!colorTable.isEmpty())
+        image.setColorTable(colorTable);
+
+    setImage(image, retainView);
+    externalImageData_ = true;
+}
+
+uchar *QImageViewerBase::originalImageBits()
+{
+    // (this only detaches from the image passed to setImage(), since
+    // background jobs do not keep copies of originalImage_)
+    if(!externalImageData_)
+        return originalImage_.bits();
+
+    // the non-const bits() would deep-copy the caller's buffer if
+    // originalImage_ is shared (e.g. with background jobs):
+    const QImage &image(originalImage_);
+    return const_cast<uchar *>(image.bits());
 }
 
 /********************************************************************/
@@ -97,25 +182,252 @@ void QImageViewerBase::setImage(QImage const &image, bool retainView)
 
 void QImageViewerBase::updateROI(QImage const &roiImage, QPoint const &upperLeft)
 {
-    int y, yy;
+    copyROI(roiImage, upperLeft);
+    markDirty(QRect(upperLeft, roiImage.size()));
+}
+
+void QImageViewerBase::copyROI(QImage const &roiImage, QPoint const &upperLeft)
+{
+    // (QImageViewer may display a tile source instead)
+    if(originalImage_.isNull())
+        return;
+
+    // (postDirty() clips, too)
+    QRect target(QRect(upperLeft, roiImage.size()) & originalImage_.rect());
+    if(target.isEmpty())
+        return;
+    QPoint offset(target.topLeft() - upperLeft);
+
+    const QImageFormatTraits &traits(
+        QImageFormatTraits::of(originalImage_.format()));
+
+    // pixels of other formats have to be converted first (even if
+    // they have the same size, e.g. RGB16 vs. RGB555), except for
+    // the alpha channel ignored by RGB32:
+    QImage roi(roiImage);
+    QImage::Format format = originalImage_.format();
+    if(roi.format() != format &&
+       !(format == QImage::Format_RGB32 &&
+         roi.format() == QImage::Format_ARGB32))
+        roi = originalImage_.colorTable().isEmpty()
+            ? roiImage.convertToFormat(format)
+            : roiImage.convertToFormat(format, originalImage_.colorTable());
 
     // update the ROI by copying the data into originalImage_
-    if(roiImage.depth() <= 8)
-        for(y= 0, yy= upperLeft.y(); y<roiImage.height(); ++y, ++yy)
+    QWriteLocker locker(imageLock());
+    uchar *bits = originalImageBits();
+    int bytesPerLine = originalImage_.bytesPerLine();
+    for(int y = target.top(); y <= target.bottom(); ++y)
+        traits.copyPixels(roi.scanLine(y - upperLeft.y()), offset.x(),
+                          bits + y*bytesPerLine, target.left(),
+                          target.width());
+}
+
+void QImageViewerBase::markDirty(QRect const &roi)
+{
+    {
+        QWriteLocker locker(imageLock());
+        updatePyramid(roi);
+    }
+
+    emit imageChanged();
+}
+
+QReadWriteLock *QImageViewerBase::imageLock()
+{
+    return 0;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*                          queued updates                          */
+/*                                                                  */
+/********************************************************************/
+
+void QImageViewerBase::postROI(QImage const &roiImage, QPoint const &upperLeft)
+{
+    copyROI(roiImage, upperLeft);
+    postDirty(QRect(upperLeft, roiImage.size()));
+}
+
+void QImageViewerBase::postDirty(QRect const &roi)
+{
+    QRect dirty(roi & QRect(QPoint(0, 0), imageSize_));
+    if(dirty.isEmpty())
+        return;
+
+    // merge with all overlapping queued ROIs (repeatedly, since
+    // the union may overlap further ones):
+    for(int i = 0; i < dirtyROIs_.size(); )
+    {
+        if(dirtyROIs_[i].contains(dirty))
         {
-            memcpy(originalImage_.scanLine(yy) + upperLeft.x(),
-                   roiImage.scanLine(y),
-                   roiImage.width());
+            ++droppedUpdateCount_;
+            return;
         }
-    else
-        for(y= 0, yy= upperLeft.y(); y<roiImage.height(); ++y, ++yy)
+        if(dirtyROIs_[i].intersects(dirty))
         {
-            memcpy(originalImage_.scanLine(yy) + 4*upperLeft.x(),
-                   roiImage.scanLine(y),
-                   4*roiImage.width());
+            dirty |= dirtyROIs_[i];
+            dirtyROIs_.remove(i);
+            ++mergedUpdateCount_;
+            i = 0;
+            continue;
         }
+        ++i;
+    }
 
-    emit imageChanged();
+    // avoid checking long lists of scattered ROIs:
+    if(dirtyROIs_.size() >= 32)
+    {
+        for(int i = 0; i < dirtyROIs_.size(); ++i)
+            dirty |= dirtyROIs_[i];
+        mergedUpdateCount_ += dirtyROIs_.size();
+        dirtyROIs_.clear();
+    }
+
+    dirtyROIs_.append(dirty);
+
+    if(!updateTimer_->isActive())
+    {
+        int delay = 0;
+        if(maxUpdateRate_ > 0 && lastUpdate_.isValid())
+            delay = std::max(
+                0, (int)(1000 / maxUpdateRate_ - lastUpdate_.elapsed()));
+        updateTimer_->start(delay);
+    }
+}
+
+void QImageViewerBase::flushDirty()
+{
+    updateTimer_->stop();
+    lastUpdate_.start();
+
+    QVector<QRect> dirtyROIs(dirtyROIs_);
+    dirtyROIs_.clear();
+    for(int i = 0; i < dirtyROIs.size(); ++i)
+        markDirty(dirtyROIs[i]);
+}
+
+void QImageViewerBase::dropQueuedUpdates()
+{
+    droppedUpdateCount_ += dirtyROIs_.size();
+    dirtyROIs_.clear();
+    updateTimer_->stop();
+}
+
+void QImageViewerBase::setMaxUpdateRate(int updatesPerSecond)
+{
+    maxUpdateRate_ = std::max(0, updatesPerSecond);
+}
+
+void QImageViewerBase::resetUpdateCounters()
+{
+    mergedUpdateCount_ = 0;
+    droppedUpdateCount_ = 0;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*                              pyramid                             */
+/*                                                                  */
+/********************************************************************/
+
+void QImageViewerBase::setPyramidEnabled(bool enabled)
+{
+    if(pyramidEnabled_ == enabled)
+        return;
+
+    pyramidEnabled_ = enabled;
+    QWriteLocker locker(imageLock());
+    buildPyramid();
+}
+
+// return the bytes per pixel suitable for reducing image, or 0 if
+// its format is not supported
+static int pyramidBytesPerPixel(const QImage &image)
+{
+    // 1-bit pixels are not byte-addressable:
+    return QImageFormatTraits::of(image.format()).bytesPerPixel();
+}
+
+void QImageViewerBase::buildPyramid()
+{
+    pyramid_.clear();
+
+    if(!pyramidEnabled_ || !pyramidBytesPerPixel(originalImage_))
+        return;
+
+    // smaller levels are not needed, since setZoomLevel() does not
+    // allow the image to become smaller than 16x16:
+    for(QSize size(originalImage_.size());
+        size.width() >= 32 || size.height() >= 32; )
+    {
+        size = QSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+        QImage level(size, originalImage_.format());
+        if(level.isNull())
+            break;
+        level.setColorTable(originalImage_.colorTable());
+        pyramid_.append(level);
+    }
+
+    updatePyramid(QRect(QPoint(0, 0), originalImage_.size()));
+}
+
+void QImageViewerBase::updatePyramid(QRect const &roi)
+{
+    if(pyramid_.isEmpty())
+        return;
+
+    int bpp = pyramidBytesPerPixel(originalImage_);
+    // averaging indices or packed channels does not make sense:
+    bool average = QImageFormatTraits::of(originalImage_.format())
+        .canInterpolate(originalImage_);
+
+    QRect r(roi & QRect(QPoint(0, 0), originalImage_.size()));
+    for(int level = 1; level <= pyramid_.size() && !r.isEmpty(); ++level)
+    {
+        const QImage &src = pyramidImage(level - 1);
+        // (the levels are not shared, so the const bits() are
+        // written without detaching them)
+        const QImage &dest = pyramid_.at(level - 1);
+
+        r = QRect(QPoint(r.left() / 2, r.top() / 2),
+                  QPoint(r.right() / 2, r.bottom() / 2));
+
+        ImageZoom::reduce(src.bits(), src.bytesPerLine(),
+                          src.width(), src.height(),
+                          const_cast<uchar *>(dest.bits()), dest.bytesPerLine(),
+                          r.left(), r.top(), r.width(), r.height(),
+                          bpp, average);
+    }
+}
+
+int QImageViewerBase::reducedLevelCount() const
+{
+    return pyramid_.size();
+}
+
+int QImageViewerBase::pyramidLevel(int zoomLevel) const
+{
+    int level = 0, levels = reducedLevelCount();
+    // use level k if 2^k <= subsampling factor:
+    for(int factor = 1 - zoomLevel; factor >= 2 && level < levels;
+        factor /= 2)
+        ++level;
+    return level;
+}
+
+int QImageViewerBase::currentPyramidLevel() const
+{
+    if(!zoomStep_)
+        return pyramidLevel(zoomLevel_);
+
+    int level = 0, levels = reducedLevelCount();
+    // use level k if 2^k <= subsampling factor:
+    for(qreal factor = 1. / zoomFactor_;
+        factor >= 2 && level < levels; factor /= 2)
+        ++level;
+    return level;
 }
 
 /********************************************************************/
@@ -126,7 +438,7 @@ void QImageViewerBase::updateROI(QImage const &roiImage, QPoint const &upperLeft
 
 int QImageViewerBase::zoomedWidth() const
 {
-    return zoom(originalImage_.width(), zoomLevel_);
+    return toZoomed(imageSize_.width());
 }
 
 /********************************************************************/
@@ -137,7 +449,7 @@ int QImageViewerBase::zoomedWidth() const
 
 int QImageViewerBase::zoomedHeight() const
 {
-    return zoom(originalImage_.height(), zoomLevel_);
+    return toZoomed(imageSize_.height());
 }
 
 /****************************************************************/
@@ -156,6 +468,21 @@ void QImageViewerBase::autoZoom(int minLevel, int maxLevel)
         return;
     }
 
+    if(fractionalZoomEnabled_)
+    {
+        if(imageSize_.isEmpty())
+            return;
+
+        // fit the image exactly, within the given zoom level range:
+        qreal factor = std::min(
+            contentsRect().width()  / (qreal)originalWidth(),
+            contentsRect().height() / (qreal)originalHeight());
+        factor = std::min(factor, zoomF(1.0, maxLevel));
+        factor = std::max(factor, zoomF(1.0, minLevel));
+        setZoomFactor(factor);
+        return;
+    }
+
     int level = maxLevel;
     while(level > minLevel && (
               zoom(originalWidth(), level) > contentsRect().width() ||
@@ -169,7 +496,7 @@ void QImageViewerBase::setUpperLeft(const QPoint &upperLeft)
 {
     setImagePosition(
         upperLeft,
-        zoomF(widgetCenter() - upperLeft, -zoomLevel_));
+        toImageF(widgetCenter() - upperLeft));
     setCenterPixel(centerPixel_);
 }
 
@@ -186,7 +513,7 @@ QPointF QImageViewerBase::centerPixelF() const
 void QImageViewerBase::setCenterPixel(const QPointF &centerPixel)
 {
     setImagePosition(
-        (widgetCenter() - zoomF(centerPixel, zoomLevel_)).toPoint(),
+        (widgetCenter() - toZoomedF(centerPixel)).toPoint(),
         centerPixel);
 }
 
@@ -213,7 +540,7 @@ QSize QImageViewerBase::sizeHint() const
 
 void QImageViewerBase::setCursorPos(QPoint const &imagePoint) const
 {
-    int offset = zoom(1, zoomLevel_) / 2;
+    int offset = (int)zoomFactor_ / 2;
     QCursor::setPos(mapToGlobal(windowCoordinate(imagePoint))
                     + QPoint(offset, offset));
 }
@@ -226,15 +553,15 @@ void QImageViewerBase::setCursorPos(QPoint const &imagePoint) const
 
 QPoint QImageViewerBase::imageCoordinate(QPoint const & windowPoint) const
 {
-    return QPoint(zoom(windowPoint.x() - upperLeft_.x(), -zoomLevel_),
-                  zoom(windowPoint.y() - upperLeft_.y(), -zoomLevel_));
+    return QPoint(toImage(windowPoint.x() - upperLeft_.x()),
+                  toImage(windowPoint.y() - upperLeft_.y()));
 }
 
 QPointF QImageViewerBase::imageCoordinateF(QPoint const &windowPoint) const
 {
     return QPointF(
-        zoomF(windowPoint.x() - upperLeft_.x(), -zoomLevel_) - 0.5,
-        zoomF(windowPoint.y() - upperLeft_.y(), -zoomLevel_) - 0.5);
+        toImageF(windowPoint.x() - upperLeft_.x()) - 0.5,
+        toImageF(windowPoint.y() - upperLeft_.y()) - 0.5);
 }
 
 /****************************************************************/
@@ -245,15 +572,15 @@ QPointF QImageViewerBase::imageCoordinateF(QPoint const &windowPoint) const
 
 QPoint QImageViewerBase::windowCoordinate(QPoint const & imagePoint) const
 {
-    return QPoint(zoom(imagePoint.x(), zoomLevel_),
-                  zoom(imagePoint.y(), zoomLevel_))
+    return QPoint(toZoomed(imagePoint.x()),
+                  toZoomed(imagePoint.y()))
         + upperLeft_;
 }
 
 QPoint QImageViewerBase::windowCoordinate(double x, double y) const
 {
-    return QPoint(qRound(zoomF(x + 0.5, zoomLevel_)),
-                  qRound(zoomF(y + 0.5, zoomLevel_)))
+    return QPoint(qRound(toZoomedF(x + 0.5)),
+                  qRound(toZoomedF(y + 0.5)))
         + upperLeft_;
 }
 
@@ -265,7 +592,7 @@ QPoint QImageViewerBase::windowCoordinate(double x, double y) const
 
 QRect QImageViewerBase::imageCoordinates(QRect const &windowRect) const
 {
-    if(zoomLevel_ > 0)
+    if(zoomFactor_ > 1)
     {
         return QRect(imageCoordinate(windowRect.topLeft()),
                      imageCoordinate(windowRect.bottomRight()));
@@ -292,7 +619,8 @@ QRectF QImageViewerBase::imageCoordinatesF(QRect const &windowRect) const
 
 QRect QImageViewerBase::windowCoordinates(QRect const &imageRect) const
 {
-    if(zoomLevel_ > 0)
+    // (fractional zooms map pixel borders exactly, even when subsampling)
+    if(zoomLevel_ > 0 || zoomStep_)
     {
         return QRect(windowCoordinate(imageRect.topLeft()),
                      windowCoordinate(imageRect.bottomRight()
@@ -313,25 +641,52 @@ QRect QImageViewerBase::windowCoordinates(QRect const &imageRect) const
 
 void QImageViewerBase::setZoomLevel(int level)
 {
-    if(zoomLevel_ == level || level > 128)
+    if(level > 128)
         return;
 
+    setZoom(level, zoomF(1.0, level));
+}
+
+bool QImageViewerBase::setZoom(int level, qreal factor)
+{
+    // factors belonging to the given level are handled without
+    // fixed-point arithmetic:
+    qreal levelFactor = zoomF(1.0, level);
+    qint64 step = 0;
+    if(fabs(factor - levelFactor) > 1e-6 * levelFactor)
+        step = ImageZoom::fixedStep(factor);
+    else
+        factor = levelFactor;
+
+    if(zoomLevel_ == level && zoomStep_ == step)
+        return false;
+
     // new width/height of entire zoomed image
-    int newWidth = zoom(originalWidth(), level);
-    int newHeight = zoom(originalHeight(), level);
+    int newWidth = step
+        ? ImageZoom::zoomedCoordinate(step, originalWidth())
+        : zoom(originalWidth(), level);
+    int newHeight = step
+        ? ImageZoom::zoomedCoordinate(step, originalHeight())
+        : zoom(originalHeight(), level);
 
     // TODO: should this move to the client/keyboard handling code?
-    if(level < 0 && ((newWidth < 16 && newHeight < 16) ||
-		     newWidth < 2 || newHeight < 2))
-        return;
+    if(factor < 1 && ((newWidth < 16 && newHeight < 16) ||
+		      newWidth < 2 || newHeight < 2))
+        return false;
 
+    bool levelChanged = zoomLevel_ != level;
     zoomLevel_ = level;
+    zoomFactor_ = factor;
+    zoomStep_ = step;
 
     setCenterPixel(centerPixel_); // think of computeUpperLeft();
 
     updateGeometry();
 
-    emit zoomLevelChanged(zoomLevel_);
+    if(levelChanged)
+        emit zoomLevelChanged(zoomLevel_);
+    emit zoomFactorChanged(zoomFactor_);
+    return true;
 }
 
 /****************************************************************/
@@ -342,10 +697,79 @@ void QImageViewerBase::setZoomLevel(int level)
 
 void QImageViewerBase::setZoomFactor(qreal factor)
 {
-    if(factor < 1.)
-        setZoomLevel(-qRound(1./factor) + 1);
-    else
-        setZoomLevel( qRound(   factor) - 1);
+    if(!(factor > 0))
+        return;
+
+    int level = (factor < 1.)
+        ? -qRound(1./factor) + 1
+        :  qRound(   factor) - 1;
+
+    if(!fractionalZoomEnabled_)
+    {
+        setZoomLevel(level);
+        return;
+    }
+
+    // same limit as setZoomLevel():
+    if(factor > 129)
+    {
+        factor = 129;
+        level = 128;
+    }
+    setZoom(level, factor);
+}
+
+/****************************************************************/
+/*                                                              */
+/*                   setFractionalZoomEnabled                   */
+/*                                                              */
+/****************************************************************/
+
+void QImageViewerBase::setFractionalZoomEnabled(bool enabled)
+{
+    fractionalZoomEnabled_ = enabled;
+    if(!enabled && zoomStep_)
+        setZoom(zoomLevel_, zoomF(1.0, zoomLevel_));
+}
+
+/****************************************************************/
+/*                                                              */
+/*                      coordinate mapping                      */
+/*                                                              */
+/****************************************************************/
+
+double QImageViewerBase::toZoomedF(double value) const
+{
+    return zoomStep_ ? value * zoomFactor_ : zoomF(value, zoomLevel_);
+}
+
+QPointF QImageViewerBase::toZoomedF(QPointF const &value) const
+{
+    return QPointF(toZoomedF(value.x()), toZoomedF(value.y()));
+}
+
+double QImageViewerBase::toImageF(double value) const
+{
+    return zoomStep_ ? value / zoomFactor_ : zoomF(value, -zoomLevel_);
+}
+
+QPointF QImageViewerBase::toImageF(QPointF const &value) const
+{
+    return QPointF(toImageF(value.x()), toImageF(value.y()));
+}
+
+int QImageViewerBase::toZoomed(int value) const
+{
+    return zoomStep_
+        ? ImageZoom::zoomedCoordinate(zoomStep_, value)
+        : zoom(value, zoomLevel_);
+}
+
+int QImageViewerBase::toImage(int value) const
+{
+    return zoomStep_
+        ? ImageZoom::sourceCoordinate(zoomStep_, value)
+        : zoom(value, -zoomLevel_);
 }
 
 /****************************************************************/
@@ -356,7 +780,13 @@ void QImageViewerBase::setZoomFactor(qreal factor)
 
 void QImageViewerBase::zoomUp()
 {
-    setZoomLevel(zoomLevel_ + 1);
+    if(!zoomStep_)
+        setZoomLevel(zoomLevel_ + 1);
+    // go to the nearest zoom level above the fractional zoom factor:
+    else if(zoomFactor_ > 1)
+        setZoomLevel((int)floor(zoomFactor_));
+    else
+        setZoomLevel((int)floor(1 - 1. / zoomFactor_) + 1);
 }
 
 /****************************************************************/
@@ -367,7 +797,13 @@ void QImageViewerBase::zoomUp()
 
 void QImageViewerBase::zoomDown()
 {
-    setZoomLevel(zoomLevel_ - 1);
+    if(!zoomStep_)
+        setZoomLevel(zoomLevel_ - 1);
+    // go to the nearest zoom level below the fractional zoom factor:
+    else if(zoomFactor_ > 1)
+        setZoomLevel((int)ceil(zoomFactor_) - 2);
+    else
+        setZoomLevel((int)ceil(1 - 1. / zoomFactor_) - 1);
 }
 
 /****************************************************************/
@@ -378,9 +814,27 @@ void QImageViewerBase::zoomDown()
 
 void QImageViewerBase::slideBy(QPoint const & diff)
 {
+    // estimate the panning velocity (averaging the rates of
+    // successive calls, since mouse events arrive irregularly):
+    qint64 ms = lastSlide_.isValid() ? lastSlide_.restart() : -1;
+    if(ms < 0)
+        lastSlide_.start();
+    if(ms < 0 || ms > PanVelocityTimeout)
+        panVelocity_ = QPointF();
+    else
+        panVelocity_ = 0.5 * panVelocity_ +
+                       0.5 * QPointF(diff) * 1000.0 / std::max<qint64>(ms, 1);
+
     setImagePosition(
         upperLeft_ + diff,
-        centerPixel_ + zoomF(-diff, -zoomLevel_));
+        centerPixel_ + toImageF(-diff));
+}
+
+QPointF QImageViewerBase::panVelocity() const
+{
+    if(!lastSlide_.isValid() || lastSlide_.elapsed() > PanVelocityTimeout)
+        return QPointF();
+    return panVelocity_;
 }
 
 bool QImageViewerBase::setImagePosition(QPoint upperLeft, QPointF centerPixel)
@@ -391,19 +845,29 @@ bool QImageViewerBase::setImagePosition(QPoint upperLeft, QPointF centerPixel)
             return false;
 
         centerPixel_ = centerPixel;
+        emit centerPixelChanged(centerPixel_);
         return true;
     }
 
     if(upperLeft_ == upperLeft)
         return false;
 
+    QPoint oldUpperLeft(upperLeft_);
+    QPointF oldCenterPixel(centerPixel_);
     upperLeft_ = upperLeft;
     centerPixel_ = centerPixel;
     checkImagePosition();
-    update();
+    scrollImage(upperLeft_ - oldUpperLeft);
+    if(centerPixel_ != oldCenterPixel)
+        emit centerPixelChanged(centerPixel_);
     return true;
 }
 
+void QImageViewerBase::scrollImage(QPoint const &)
+{
+    update();
+}
+
 /********************************************************************/
 /*                                                                  */
 /*                        checkImagePosition                        */
@@ -572,7 +1036,10 @@ void QImageViewerBase::wheelEvent(QWheelEvent *e)
 {
     if(!isEnabled())
         return;
-    if(e->delta() > 0)
+    if(fractionalZoomEnabled_)
+        // zoom continuously, by a factor of 2 per four wheel steps:
+        setZoomFactor(zoomFactor_ * pow(2.0, e->delta() / 480.0));
+    else if(e->delta() > 0)
         zoomUp();
     else if(e->delta() < 0)
         zoomDown();
@@ -613,7 +1080,7 @@ void QImageViewerBase::keyPressEvent(QKeyEvent *e)
 
     if(!moveOffset.isNull())
     {
-        if(zoomLevel_ > 1)
+        if(zoomFactor_ > 2)
         {
             QCursor::setPos(
                 mapToGlobal(
@@ -665,270 +1132,1503 @@ void QImageViewerBase::showEvent(QShowEvent *e)
 /*                                                              */
 /****************************************************************/
 
-QImageViewer::QImageViewer(QWidget *parent)
-: QImageViewerBase(parent)
-{
-    connect(this, SIGNAL(zoomLevelChanged(int)), SLOT(createDrawingPixmap()));
-    setBackgroundRole(QPalette::Dark);
-}
-
-void QImageViewer::setImage(QImage const &image, bool retainView)
-{
-    QImageViewerBase::setImage(image, retainView);
-    createDrawingPixmap();
-    update();
-}
+/****************************************************************/
+/*                                                              */
+/*                      parallel rendering                      */
+/*                                                              */
+/****************************************************************/
 
-void QImageViewer::updateROI(QImage const &roiImage, QPoint const &upperLeft)
+// QRunnable executing a task functor and signalling its completion
+template<class TASK>
+class SemaphoreRunnable : public QRunnable
 {
-    QImageViewerBase::updateROI(roiImage, upperLeft);
-
-    QRect updateRect(
-        drawingPixmapDomain_                  // cached image region
-        & QRect(upperLeft, roiImage.size())); // intersected with given ROI;
+  public:
+    SemaphoreRunnable(TASK &task, QSemaphore &done)
+    : task_(task), done_(done)
+    {}
 
-    if(updateRect.isEmpty())
-        return;
+    virtual void run()
+    {
+        task_();
+        done_.release();
+    }
 
-    // width/height of zoomed ROI
-    int newWidth = zoom(updateRect.width(), zoomLevel_);
-    int newHeight = zoom(updateRect.height(), zoomLevel_);
+  private:
+    TASK &task_;
+    QSemaphore &done_;
+};
 
-    if(newWidth <= 0 || newHeight <= 0)
+// run all tasks on the global thread pool (the first one in the
+// calling thread) and wait until they are finished
+template<class TASK>
+static void runParallel(QVector<TASK> &tasks)
+{
+    if(tasks.isEmpty())
         return;
 
-    // allocate zoomed image
-    QImage zoomed(newWidth, newHeight, originalImage_.format());
-    zoomed.setColorCount(originalImage_.colorCount());
-    for(int i=0; i<originalImage_.colorCount(); ++i)
-        zoomed.setColor(i, originalImage_.color(i));
+    QSemaphore done;
+    for(int i = 1; i < tasks.size(); ++i)
+        QThreadPool::globalInstance()->start(
+            new SemaphoreRunnable<TASK>(tasks[i], done));
+    tasks[0]();
+    done.acquire(tasks.size() - 1);
+}
 
-    // fill zoomed image
-    zoomImage(updateRect.left(), updateRect.top(), zoomed);
+struct ZoomBandTask
+{
+    const ImageZoom *imageZoom;
+    const uchar *srcBits;
+    uchar *destBits;
+    int srcBytesPerLine, destBytesPerLine, top, beginRow, endRow;
 
-    // put image into drawingPixmap_
-    QPainter p(&drawingPixmap_);
-    p.drawImage(
-        QPoint(zoom(updateRect.left() - drawingPixmapDomain_.left(), zoomLevel_),
-               zoom(updateRect.top()  - drawingPixmapDomain_.top(),  zoomLevel_)),
-        zoomed);
-    p.end();
+    void operator()() const
+    {
+        imageZoom->zoomRows(srcBits, srcBytesPerLine, top,
+                            destBits, destBytesPerLine, beginRow, endRow);
+    }
+};
 
-    update(windowCoordinates(updateRect));
+// resample the part of image zoomed by zoomFactor starting at
+// zoomedRect.topLeft() into dest (with the size of zoomedRect)
+static void scaleRegionInto(QImage const &image, QRect const &zoomedRect,
+                            qreal zoomFactor, int sourceShift, bool smooth,
+                            QImage &dest)
+{
+    const QImageFormatTraits &traits(QImageFormatTraits::of(image.format()));
+    // interpolating indices or packed channels does not make sense:
+    bool bilinear = smooth && traits.canInterpolate(image);
+    ImageZoom imageZoom(ImageZoom::fixedStep(zoomFactor), zoomedRect.left(),
+                        dest.width(), image.width(), image.height(),
+                        traits.zoomPixelSize, sourceShift, bilinear);
+    imageZoom.zoomRows(image.bits(), image.bytesPerLine(), zoomedRect.top(),
+                       dest.bits(), dest.bytesPerLine(),
+                       0, dest.height());
 }
 
-/****************************************************************/
-/*                                                              */
-/*                            slideBy                           */
-/*                                                              */
-/****************************************************************/
-
-void QImageViewer::slideBy(QPoint const & diff)
+struct QImageViewerTileTask
 {
-    QImageViewerBase::slideBy(diff);
+    QImageViewer *viewer;
+    QVector<QImageViewerTileKey> keys;
+    QVector<QImage> images;
 
-    update();
-}
+    void operator()()
+    {
+        for(int i = 0; i < keys.size(); ++i)
+            images.append(viewer->renderTile(keys[i]));
+    }
+};
+
+struct QImageViewerFrameTask
+{
+    QImageViewer *viewer;
+    QVector<QImageViewerTileKey> keys;
+    QVector<QImage *> dests;
 
+    void operator()()
+    {
+        for(int i = 0; i < keys.size(); ++i)
+            viewer->renderTileInto(keys[i], *dests[i]);
+    }
+};
 
 /****************************************************************/
 /*                                                              */
-/*                     createDrawingPixmap                      */
+/*                       async rendering                        */
 /*                                                              */
 /****************************************************************/
 
-void QImageViewer::createDrawingPixmap()
+// State shared between a QImageViewer and its background jobs; it
+// outlives the viewer as long as there are jobs referring to it.
+struct QImageViewerAsyncState
 {
-    if(originalImage_.isNull())
+    struct Result
     {
-        if(!drawingPixmap_.isNull())
-        {
-            drawingPixmap_ = QPixmap();
-            update();
-        }
-        return;
-    }
+        QImageViewerTileKey key;
+        int imageGeneration;
+        QImage image; // null if the job was skipped
 
-    QRect r = cachedImageROI();
+        Result(QImageViewerTileKey const &k, int generation, QImage const &i)
+        : key(k), imageGeneration(generation), image(i)
+        {}
+    };
 
-    if(r.isEmpty())
-        return;
+    QMutex mutex;
+    QImageViewer *viewer; // reset to 0 when the viewer is destroyed
 
-    QImage zoomed(zoom(r.width(), zoomLevel_),
-                  zoom(r.height(), zoomLevel_),
-                  originalImage_.format());
+        // read-locked by jobs while zooming the viewer's image or
+        // pyramid, which are only changed (or the viewer destroyed)
+        // with the lock write-locked (see imageLock()):
+    QReadWriteLock sourceLock;
+    int imageGeneration;
 
-    zoomed.setColorCount(originalImage_.colorCount());
-    for(int i=0; i<originalImage_.colorCount(); ++i)
-        zoomed.setColor(i, originalImage_.color(i));
+        // tiles not of this zoom or outside this ROI are no longer
+        // needed:
+    int wantedZoomLevel;
+    qint64 wantedZoomStep;
+    QRect wantedROI;
 
-    zoomImage(r.left(), r.top(), zoomed);
+    QList<Result> results;
 
-    drawingPixmap_ = QPixmap::fromImage(zoomed);
-    drawingPixmapDomain_ = r;
-}
+    QImageViewerAsyncState(QImageViewer *v)
+    : viewer(v),
+      imageGeneration(0),
+      wantedZoomLevel(0),
+      wantedZoomStep(0)
+    {}
+};
 
+class AsyncTileJob : public QRunnable
+{
+  public:
+    AsyncTileJob(QSharedPointer<QImageViewerAsyncState> const &state,
+                 QImageViewerTileKey const &key, QRect const &roi,
+                 int sourceShift, int imageGeneration)
+    : state_(state),
+      key_(key),
+      roi_(roi),
+      sourceShift_(sourceShift),
+      imageGeneration_(imageGeneration),
+      zoomFactor_(1.0),
+      smooth_(false),
+      prefetch_(false)
+    {}
+
+        // for tiles of a tile source (instead of the viewer's image)
+    void setTileSource(QSharedPointer<QImageTileSource> const &tileSource)
+    {
+        tileSource_ = tileSource;
+    }
 
-/********************************************************************/
-/*                                                                  */
-/*                          cachedImageROI                          */
-/*                                                                  */
-/********************************************************************/
+        // prefetched tiles are rendered even if not visible
+    void setPrefetch(bool prefetch)
+    {
+        prefetch_ = prefetch;
+    }
 
-QRect QImageViewer::cachedImageROI()
-{
-    if(originalImage_.isNull())
+        // for tiles of fractional zoom factors, which are resampled
+        // by scaleRegion() instead
+    void setFractionalZoom(QRect const &zoomedRect, qreal zoomFactor,
+                           bool smooth)
     {
-        qWarning("cachedImageROI called with no image set!");
-        return QRect();
+        zoomedRect_ = zoomedRect;
+        zoomFactor_ = zoomFactor;
+        smooth_ = smooth;
     }
 
-    // initialize result with widget rect projected into image CS:
-    QRect
-        cr(contentsRect()),
-        result(imageCoordinates(cr));
+    virtual void run()
+    {
+        QReadLocker sourceLocker(&state_->sourceLock);
 
-    // add another half of the current extent at every border:
-    result.adjust(-zoom(cr.width()  / 2, -zoomLevel_),
-                  -zoom(cr.height() / 2, -zoomLevel_),
-                  +zoom(cr.width()  / 2, -zoomLevel_),
-                  +zoom(cr.height() / 2, -zoomLevel_));
+        bool wanted;
+        {
+            QMutexLocker locker(&state_->mutex);
+            wanted = state_->viewer &&
+                     imageGeneration_ == state_->imageGeneration &&
+                     (prefetch_ ||
+                      (key_.zoomLevel == state_->wantedZoomLevel &&
+                       key_.step == state_->wantedZoomStep &&
+                       roi_.intersects(state_->wantedROI)));
+        }
 
-    // crop to original image:
-    result &= QRect(QPoint(0, 0), originalImage_.size());
+        // the viewer's image and pyramid are read in place (not
+        // shared, so that writing them does not detach them); they
+        // are only changed with sourceLock write-locked, and replaced
+        // after the next imageGeneration:
+        QImage zoomed;
+        if(wanted && tileSource_ && key_.step)
+            zoomed = QImageViewer::scaleRegion(
+                *tileSource_, zoomedRect_, zoomFactor_, sourceShift_, smooth_);
+        else if(wanted && tileSource_)
+            zoomed = QImageViewer::zoomRegion(
+                *tileSource_, roi_, key_.zoomLevel, sourceShift_);
+        else if(wanted && key_.step)
+            zoomed = QImageViewer::scaleRegion(
+                state_->viewer->pyramidImage(sourceShift_),
+                zoomedRect_, zoomFactor_, sourceShift_, smooth_);
+        else if(wanted)
+            zoomed = QImageViewer::zoomRegion(
+                state_->viewer->pyramidImage(sourceShift_),
+                roi_, key_.zoomLevel, sourceShift_);
+        sourceLocker.unlock();
+
+        QMutexLocker locker(&state_->mutex);
+        if(!state_->viewer)
+            return;
+        state_->results.append(
+            QImageViewerAsyncState::Result(key_, imageGeneration_, zoomed));
+        if(state_->results.size() == 1)
+            QMetaObject::invokeMethod(state_->viewer, "collectRenderedTiles",
+                                      Qt::QueuedConnection);
+    }
 
-    return result;
-}
+  private:
+    QSharedPointer<QImageViewerAsyncState> state_;
+    QImageViewerTileKey key_;
+    QRect roi_, zoomedRect_;
+    QSharedPointer<QImageTileSource> tileSource_;
+    int sourceShift_, imageGeneration_;
+    qreal zoomFactor_;
+    bool smooth_, prefetch_;
+};
 
+/****************************************************************/
 
-void QImageViewer::checkDrawingPixmap()
+QImageViewer::QImageViewer(QWidget *parent)
+: QImageViewerBase(parent),
+  tiles_(64*1024),
+  sparePixmapCost_(0),
+  renderThreadCount_(std::max(1, QThread::idealThreadCount())),
+  parallelThreshold_(512*512),
+  asyncRendering_(false),
+  smoothZoom_(false),
+  directZoomThreshold_(16),
+  asyncState_(new QImageViewerAsyncState(this)),
+  imageGeneration_(0),
+  prefetchBudget_(16*1024),
+  prefetchTimer_(new QTimer(this)),
+  prefetchQueueValid_(false),
+  frameProvider_(0),
+  playbackTimer_(new QTimer(this)),
+  playbackFps_(25),
+  playbackCount_(0),
+  playbackFrame_(0),
+  droppedFrameCount_(0),
+  renderStatsEnabled_(false)
 {
-    QRect needed(imageCoordinates(contentsRect()) &
-                 QRect(QPoint(0, 0), originalImage_.size()));
-    if(!drawingPixmapDomain_.contains(needed))
-        // TODO: re-use existing part!?
-        createDrawingPixmap();
+    connect(this, SIGNAL(zoomFactorChanged(qreal)), SLOT(update()));
+    setBackgroundRole(QPalette::Dark);
+
+    // a zero-interval timer fires whenever the event loop is idle:
+    prefetchTimer_->setInterval(0);
+    connect(prefetchTimer_, SIGNAL(timeout()), SLOT(prefetchNextTile()));
+    connect(playbackTimer_, SIGNAL(timeout()), SLOT(playNextFrame()));
+
+    // VIGRAQT_RENDER_STATS=<milliseconds> enables periodic logging:
+    QByteArray logInterval(qgetenv("VIGRAQT_RENDER_STATS"));
+    if(!logInterval.isEmpty())
+    {
+        setRenderStatsEnabled(true);
+        QTimer *logTimer = new QTimer(this);
+        connect(logTimer, SIGNAL(timeout()), SLOT(logRenderStats()));
+        logTimer->start(logInterval.toInt() > 0 ? logInterval.toInt() : 1000);
+    }
 }
 
-bool QImageViewer::setImagePosition(QPoint upperLeft, QPointF centerPixel)
+QImageViewer::~QImageViewer()
 {
-    bool result = QImageViewerBase::setImagePosition(upperLeft, centerPixel);
-    return result;
+    QWriteLocker sourceLocker(&asyncState_->sourceLock);
+    QMutexLocker locker(&asyncState_->mutex);
+    asyncState_->viewer = 0;
 }
 
+void QImageViewer::setImage(QImage const &image, bool retainView)
+{
+    // (QImageViewerBase::setImage() waits for background jobs still
+    // reading the previous image, e.g. a caller's buffer which may be
+    // freed after we return)
+    nextImageGeneration();
+
+    clearTileCache();
+    tileSource_.clear();
+    QImageViewerBase::setImage(image, retainView);
+    update();
+}
+
+void QImageViewer::setTileSource(QImageTileSource *source, bool retainView)
+{
+    nextImageGeneration();
+
+    clearTileCache();
+    {
+        QWriteLocker sourceLocker(&asyncState_->sourceLock);
+        originalImage_ = QImage();
+        externalImageData_ = false;
+        pyramid_.clear();
+    }
+
+    // (background jobs share ownership of the source)
+    tileSource_ = QSharedPointer<QImageTileSource>(source);
+    setImageSize(source ? source->size() : QSize(0, 0), retainView);
+
+    emit imageChanged();
+    update();
+}
+
+int QImageViewer::reducedLevelCount() const
+{
+    if(tileSource_)
+        return tileSource_->levelCount();
+    return QImageViewerBase::reducedLevelCount();
+}
+
+void QImageViewer::markDirty(QRect const &roi)
+{
+    QImageViewerBase::markDirty(roi);
+    outdatePendingTiles(roi);
+
+    QRect changed(updateCachedTiles(roi));
+    if(!changed.isEmpty())
+        update(changed);
+}
+
+void QImageViewer::markDirtyBeforePaint(QRect const &roi)
+{
+    QImageViewerBase::markDirty(roi);
+    outdatePendingTiles(roi);
+
+    updateCachedTiles(roi);
+}
+
+void QImageViewer::outdatePendingTiles(QRect const &roi)
+{
+    // results of background jobs that may have read the old pixels
+    // are dropped (and the tiles re-scheduled when painted); pixels
+    // of reduced levels depend on whole blocks of the image:
+    foreach(QImageViewerTileKey key, pendingTiles_)
+    {
+        int margin = 2 << (key.step ? currentPyramidLevel()
+                                    : pyramidLevel(key.zoomLevel));
+        if(tileImageROI(key).intersects(
+               roi.adjusted(-margin, -margin, margin, margin)))
+            outdatedTiles_.insert(key);
+    }
+}
+
+QRect QImageViewer::updateCachedTiles(QRect const &roi)
+{
+    QRect imageRect(QPoint(0, 0), imageSize_);
+    QRect dirty(roi & imageRect);
+
+    // pixels of fractional zooms may depend on neighboring image
+    // pixels (interpolation) and on whole pyramid blocks:
+    int margin = 2 << currentPyramidLevel();
+    QRect affected(dirty.adjusted(-margin, -margin, margin, margin));
+
+    foreach(QImageViewerTileKey key, tiles_.keys())
+    {
+        if(key.step)
+        {
+            // fractional tiles are re-rendered on demand; tiles of
+            // other zoom factors are unlikely to be reused:
+            if(key.step != zoomStep_ || tileImageROI(key).intersects(affected))
+                discardTile(key);
+            continue;
+        }
+
+        int s = tileSourceSize(key.zoomLevel);
+        QRect tileROI(QRect(key.x * s, key.y * s, s, s) & dirty);
+        if(tileROI.isEmpty())
+            continue;
+
+        if(key.zoomLevel != zoomLevel_ || zoomLevel_ < 0 || zoomStep_ ||
+           tileSource_)
+        {
+            // tiles of other zoom levels are re-rendered on demand;
+            // subsampled tiles are cheap, and partial updates would
+            // have to be aligned with the subsampling grid (tiles of
+            // a tile source are re-fetched by background jobs):
+            discardTile(key);
+            continue;
+        }
+
+        QImage zoomed(zoomedImage(tileROI));
+
+        // put image into cached tile
+        QPainter p(tiles_.object(key));
+        p.drawImage(
+            QPoint(zoom(tileROI.left() - key.x * s, zoomLevel_),
+                   zoom(tileROI.top()  - key.y * s, zoomLevel_)),
+            zoomed);
+        p.end();
+        QImageBufferPool::globalInstance()->recycle(zoomed);
+    }
+
+    if(dirty.isEmpty())
+        return QRect();
+    return windowCoordinates(zoomStep_ ? affected & imageRect : dirty);
+}
 
 /****************************************************************/
 /*                                                              */
-/*                            zoomImage                         */
+/*                          scrollImage                         */
 /*                                                              */
 /****************************************************************/
 
-void QImageViewer::zoomImage(int left, int top, QImage & dest)
+void QImageViewer::scrollImage(QPoint const &offset)
+{
+    if(offset.isNull())
+        return;
+
+    // QWidget::scroll() blits the pixels still visible and repaints
+    // the exposed strips only (the frame is not scrolled):
+    QRect cr(contentsRect());
+    if(qAbs(offset.x()) < cr.width() && qAbs(offset.y()) < cr.height())
+        scroll(offset.x(), offset.y(), cr);
+    else
+        update();
+}
+
+QVector<QRect> QImageViewer::paintRects(QPaintEvent *e)
+{
+    QVector<QRect> result(e->region().rects());
+    if(result.size() > 4)
+    {
+        // many small rects are painted faster in one go:
+        result.clear();
+        result.append(e->rect());
+    }
+    return result;
+}
+
+/****************************************************************/
+/*                                                              */
+/*                          tile cache                          */
+/*                                                              */
+/****************************************************************/
+
+void QImageViewer::setPyramidEnabled(bool enabled)
+{
+    if(enabled == pyramidEnabled_)
+        return;
+
+    // (before the pyramid levels read by background jobs change)
+    nextImageGeneration();
+    QImageViewerBase::setPyramidEnabled(enabled);
+    clearTileCache();
+    update();
+}
+
+void QImageViewer::setTileCacheSize(int kiloBytes)
+{
+    tiles_.setMaxCost(kiloBytes);
+}
+
+void QImageViewer::clearTileCache()
+{
+    foreach(QImageViewerTileKey key, tiles_.keys())
+        discardTile(key);
+}
+
+int QImageViewer::tileSourceSize(int zoomLevel)
+{
+    return std::max(1, zoom(TileSize, -zoomLevel));
+}
+
+QImageViewerTileKey QImageViewer::tileKey(QPoint const &position) const
+{
+    return QImageViewerTileKey(zoomLevel_, position.x(), position.y(),
+                               zoomStep_);
+}
+
+QRect QImageViewer::tileImageROI(QImageViewerTileKey const &key) const
 {
-    int w = dest.width();
-    int h = dest.height();
+    QRect imageRect(QPoint(0, 0), imageSize_);
+    if(key.step)
+    {
+        QRect r(tileZoomedRect(key));
+        if(r.isEmpty())
+            return QRect();
+        return QRect(
+            QPoint(ImageZoom::sourceCoordinate(key.step, r.left()),
+                   ImageZoom::sourceCoordinate(key.step, r.top())),
+            QPoint(ImageZoom::sourceCoordinate(key.step, r.right()),
+                   ImageZoom::sourceCoordinate(key.step, r.bottom())))
+            & imageRect;
+    }
 
-    if(zoomLevel_ > 0)
+    int s = tileSourceSize(key.zoomLevel);
+    return QRect(key.x * s, key.y * s, s, s) & imageRect;
+}
+
+QRect QImageViewer::tileZoomedRect(QImageViewerTileKey const &key) const
+{
+    if(key.step)
     {
-        int f = zoomLevel_ + 1;
+        QRect zoomedImageRect(
+            0, 0,
+            ImageZoom::zoomedCoordinate(key.step, imageSize_.width()),
+            ImageZoom::zoomedCoordinate(key.step, imageSize_.height()));
+        return QRect(key.x * TileSize, key.y * TileSize, TileSize, TileSize)
+            & zoomedImageRect;
+    }
 
-        if(originalImage_.depth() <= 8)
-        {
-            for(int y=0; y<h; ++y)
-            {
-                int yy = top + zoom(y, -zoomLevel_);
+    QRect roi(tileImageROI(key));
+    return QRect(zoom(roi.left(), key.zoomLevel),
+                 zoom(roi.top(), key.zoomLevel),
+                 zoom(roi.width(), key.zoomLevel),
+                 zoom(roi.height(), key.zoomLevel));
+}
 
-                uchar *d = dest.scanLine(y);
-                uchar *s = originalImage_.scanLine(yy) + left;
+QRect QImageViewer::tileWindowRect(QImageViewerTileKey const &key) const
+{
+    return tileZoomedRect(key).translated(upperLeft_);
+}
 
-                for(int x=0; x<w; ++x, ++d)
-                {
-                    *d = s[x/f];
-                }
-            }
+QImage QImageViewer::renderTile(QImageViewerTileKey const &key)
+{
+    int level = currentPyramidLevel();
+    if(tileSource_)
+        return key.step
+            ? scaleRegion(*tileSource_, tileZoomedRect(key),
+                          zoomFactor_, level, smoothZoom_)
+            : zoomRegion(*tileSource_, tileImageROI(key), zoomLevel_, level);
+
+    if(!key.step)
+        return zoomedImage(tileImageROI(key));
+
+    return scaleRegion(pyramidImage(level), tileZoomedRect(key),
+                       zoomFactor_, level, smoothZoom_);
+}
+
+void QImageViewer::renderTileInto(QImageViewerTileKey const &key,
+                                  QImage &dest)
+{
+    if(!key.step)
+    {
+        QRect roi(tileImageROI(key));
+        zoomImage(roi.left(), roi.top(), dest);
+        return;
+    }
+
+    int level = currentPyramidLevel();
+    scaleRegionInto(pyramidImage(level), tileZoomedRect(key),
+                    zoomFactor_, level, smoothZoom_, dest);
+}
+
+QVector<QPoint> QImageViewer::tilePositions(QRect const &windowRect) const
+{
+    QVector<QPoint> result;
+    QRect drawROI(imageCoordinates(windowRect) &
+                  QRect(QPoint(0, 0), imageSize_));
+    if(drawROI.isEmpty())
+        return result;
+
+    // tiles of fractional zooms cover TileSize x TileSize zoomed pixels:
+    QRect tileROI(drawROI);
+    int s = tileSourceSize(zoomLevel_);
+    if(zoomStep_)
+    {
+        tileROI = windowRect.translated(-upperLeft_)
+            & QRect(0, 0, zoomedWidth(), zoomedHeight());
+        if(tileROI.isEmpty())
+            return result;
+        s = TileSize;
+    }
+
+    for(int ty = tileROI.top() / s; ty <= tileROI.bottom() / s; ++ty)
+        for(int tx = tileROI.left() / s; tx <= tileROI.right() / s; ++tx)
+            result.append(QPoint(tx, ty));
+    return result;
+}
+
+void QImageViewer::setDirectZoomThreshold(int level)
+{
+    if(level == directZoomThreshold_)
+        return;
+
+    directZoomThreshold_ = level;
+    update();
+}
+
+void QImageViewer::setRenderThreadCount(int count)
+{
+    renderThreadCount_ = std::max(1, count);
+}
+
+void QImageViewer::setParallelThreshold(int pixels)
+{
+    parallelThreshold_ = pixels;
+}
+
+QVector<QPixmap> QImageViewer::tiles(QVector<QPoint> const &positions)
+{
+    QVector<QPixmap> result(positions.size());
+
+    // look up cached tiles, distribute missing ones over the tasks:
+    QVector<int> missing;
+    QVector<QImageViewerTileTask> tasks(
+        std::min(renderThreadCount_, positions.size()));
+    for(int i = 0; i < positions.size(); ++i)
+    {
+        QImageViewerTileKey key(tileKey(positions[i]));
+        if(QPixmap *cached = cachedTile(key))
+        {
+            result[i] = *cached;
+            continue;
         }
+
+        QImageViewerTileTask &task(tasks[missing.size() % tasks.size()]);
+        task.viewer = this;
+        task.keys.append(key);
+        missing.append(i);
+    }
+
+    if(renderStatsEnabled_)
+    {
+        renderStats_.tileHits += positions.size() - missing.size();
+        renderStats_.tileMisses += missing.size();
+    }
+
+    if(missing.isEmpty())
+        return result;
+
+    if(missing.size() < tasks.size())
+        tasks.resize(missing.size());
+    {
+        RenderTimer zoomTimer(renderStat(&QImageViewerRenderStats::zoomTime));
+        if(QThread::currentThread() == thread() && tasks.size() > 1)
+            runParallel(tasks);
         else
-        {
-            for(int y=0; y<h; ++y)
-            {
-                int yy = top + zoom(y, -zoomLevel_);
+            for(int t = 0; t < tasks.size(); ++t)
+                tasks[t]();
+    }
 
-                QRgb *d = (QRgb *)dest.scanLine(y);
-                QRgb *s = (QRgb *)originalImage_.scanLine(yy) + left;
+    // convert to pixmaps (which is only possible in the GUI thread)
+    // and put them into the cache:
+    RenderTimer convertTimer(renderStat(&QImageViewerRenderStats::convertTime));
+    for(int m = 0; m < missing.size(); ++m)
+    {
+        int i = missing[m];
+        QImage &zoomed(tasks[m % tasks.size()].images[m / tasks.size()]);
+        if(zoomed.isNull())
+            continue;
+
+        result[i] = tilePixmap(zoomed);
+        QImageBufferPool::globalInstance()->recycle(zoomed);
+        cacheTile(tileKey(positions[i]), result[i]);
+    }
 
-                for(int x=0; x<w; ++x, ++d)
-                {
-                    *d = s[x/f];
-                }
-            }
+    return result;
+}
+
+QPixmap *QImageViewer::cachedTile(QImageViewerTileKey const &key)
+{
+    if(QPixmap *cached = tiles_.object(key))
+        return cached;
+
+    if(!group() || !group()->tileSharingEnabled())
+        return 0;
+
+    foreach(QImageViewerBase *member, group()->viewers())
+    {
+        QImageViewer *other = qobject_cast<QImageViewer *>(member);
+        if(!other || other == this || !sharesTilesWith(*other))
+            continue;
+
+        if(QPixmap *shared = other->tiles_.object(key))
+        {
+            // QPixmaps are implicitly shared, so no pixels are copied
+            // (both caches account for the tile, though):
+            int cost = shared->width() * shared->height() * 4 / 1024;
+            tiles_.insert(key, new QPixmap(*shared), std::max(1, cost));
+            return tiles_.object(key);
         }
     }
-    else if(zoomLevel_ == 0)
+    return 0;
+}
+
+bool QImageViewer::sharesTilesWith(QImageViewer const &other) const
+{
+    // tile sources are owned by one viewer each; subclasses may
+    // overload zoomImage():
+    if(tileSource_ || other.tileSource_ ||
+       metaObject() != other.metaObject() ||
+       pyramidEnabled_ != other.pyramidEnabled_ ||
+       smoothZoom_ != other.smoothZoom_)
+        return false;
+
+    return !originalImage_.isNull() &&
+        originalImage_.cacheKey() == other.originalImage_.cacheKey();
+}
+
+QReadWriteLock *QImageViewer::imageLock()
+{
+    return &asyncState_->sourceLock;
+}
+
+void QImageViewer::nextImageGeneration()
+{
+    QMutexLocker locker(&asyncState_->mutex);
+    asyncState_->imageGeneration = ++imageGeneration_;
+    // (all pending results are outdated now)
+    outdatedTiles_.clear();
+}
+
+void QImageViewer::cacheTile(QImageViewerTileKey const &key,
+                             QPixmap const &pixmap)
+{
+    // cost is the (approximate) pixmap size in kilobytes:
+    int cost = pixmap.width() * pixmap.height() * 4 / 1024;
+    tiles_.insert(key, new QPixmap(pixmap), std::max(1, cost));
+}
+
+void QImageViewer::discardTile(QImageViewerTileKey const &key)
+{
+    QPixmap *pixmap = tiles_.take(key);
+    if(!pixmap)
+        return;
+
+    int cost = pixmap->width() * pixmap->height() * 4 / 1024;
+    if(sparePixmapCost_ + cost <= tiles_.maxCost() / 4)
+    {
+        sparePixmaps_.append(*pixmap);
+        sparePixmapCost_ += cost;
+    }
+    delete pixmap;
+}
+
+QPixmap QImageViewer::tilePixmap(QImage const &zoomed)
+{
+    // (1-bit images may be converted to bitmaps, and alpha channels
+    // must be preserved)
+    if(zoomed.depth() > 1)
     {
-        if(originalImage_.depth() <= 8)
+        for(int i = sparePixmaps_.size() - 1; i >= 0; --i)
         {
-            for(int y=0; y<h; ++y)
-            {
-                int yy = top + zoom(y, -zoomLevel_);
+            if(sparePixmaps_[i].size() != zoomed.size() ||
+               sparePixmaps_[i].depth() == 1 ||
+               sparePixmaps_[i].hasAlphaChannel() != zoomed.hasAlphaChannel())
+                continue;
+
+            QPixmap pixmap(sparePixmaps_.takeAt(i));
+            sparePixmapCost_ -= pixmap.width() * pixmap.height() * 4 / 1024;
+
+            QPainter p(&pixmap);
+            p.setCompositionMode(QPainter::CompositionMode_Source);
+            p.drawImage(0, 0, zoomed);
+            p.end();
+
+            if(renderStatsEnabled_)
+                renderStats_.recycledBytes += pixmap.width() * pixmap.height() * 4;
+            return pixmap;
+        }
+    }
 
-                uchar *d = dest.scanLine(y), *dend = d+w;
-                uchar *s = originalImage_.scanLine(yy) + left;
+    if(renderStatsEnabled_)
+        renderStats_.allocatedBytes += zoomed.width() * zoomed.height() * 4;
+    return QPixmap::fromImage(zoomed);
+}
 
-                for(; d != dend; ++d, ++s)
-                {
-                    *d = *s;
-                }
-            }
-        }
-        else
+/****************************************************************/
+/*                                                              */
+/*                        async rendering                       */
+/*                                                              */
+/****************************************************************/
+
+void QImageViewer::setAsyncRendering(bool async)
+{
+    asyncRendering_ = async;
+}
+
+void QImageViewer::setSmoothZoom(bool smooth)
+{
+    if(smooth == smoothZoom_)
+        return;
+
+    smoothZoom_ = smooth;
+    nextImageGeneration();
+
+    // only tiles of fractional zoom factors are affected:
+    foreach(QImageViewerTileKey key, tiles_.keys())
+        if(key.step)
+            discardTile(key);
+    update();
+}
+
+void QImageViewer::scheduleTile(QImageViewerTileKey const &key, bool prefetch)
+{
+    if(pendingTiles_.contains(key))
+        return;
+    pendingTiles_.insert(key);
+
+    int level = key.zoomLevel == zoomLevel_ && key.step == zoomStep_
+        ? currentPyramidLevel() : pyramidLevel(key.zoomLevel);
+    AsyncTileJob *job = new AsyncTileJob(
+        asyncState_, key, tileImageROI(key), level, imageGeneration_);
+    if(tileSource_)
+        job->setTileSource(tileSource_);
+    if(key.step)
+        job->setFractionalZoom(tileZoomedRect(key), zoomFactor_, smoothZoom_);
+    job->setPrefetch(prefetch);
+    QThreadPool::globalInstance()->start(job, prefetch ? -1 : 0);
+}
+
+void QImageViewer::collectRenderedTiles()
+{
+    QList<QImageViewerAsyncState::Result> results;
+    {
+        QMutexLocker locker(&asyncState_->mutex);
+        results = asyncState_->results;
+        asyncState_->results.clear();
+    }
+
+    RenderTimer convertTimer(renderStat(&QImageViewerRenderStats::convertTime));
+    foreach(QImageViewerAsyncState::Result const &result, results)
+    {
+        pendingTiles_.remove(result.key);
+        bool outdated = outdatedTiles_.remove(result.key);
+
+        if(!result.image.isNull() && result.imageGeneration == imageGeneration_ &&
+           !outdated)
         {
-            for(int y=0; y<h; ++y)
-            {
-                int yy = top + zoom(y, -zoomLevel_);
+            QImage zoomed(result.image);
+            cacheTile(result.key, tilePixmap(zoomed));
+            QImageBufferPool::globalInstance()->recycle(zoomed);
+        }
+
+        // repaint (which re-schedules skipped or outdated tiles if
+        // they are still visible):
+        if(result.key.zoomLevel == zoomLevel_ && result.key.step == zoomStep_)
+            update(tileWindowRect(result.key));
+    }
+}
 
-                QRgb *d = (QRgb *)dest.scanLine(y), *dend = d+w;
-                QRgb *s = (QRgb *)originalImage_.scanLine(yy) + left;
+void QImageViewer::paintTilePreview(QPainter &p, QPoint const &position)
+{
+    QRect roi(tileImageROI(tileKey(position)));
+    QRect imageRect(QPoint(0, 0), imageSize_);
 
-                for(; d != dend; ++d, ++s)
+    // look for cached tiles of the nearest other zoom level (which
+    // may be the nearest one for fractional zoom factors):
+    for(int distance = zoomStep_ ? 0 : 1; distance <= 8; ++distance)
+    {
+        bool found = false;
+        for(int sign = -1; sign <= 1; sign += 2)
+        {
+            if(!distance && sign > 0)
+                break;
+            int level = zoomLevel_ + sign * distance, s = tileSourceSize(level);
+            for(int ty = roi.top() / s; ty <= roi.bottom() / s; ++ty)
+            {
+                for(int tx = roi.left() / s; tx <= roi.right() / s; ++tx)
                 {
-                    *d = *s;
+                    QPixmap *cached = tiles_.object(
+                        QImageViewerTileKey(level, tx, ty));
+                    if(!cached)
+                        continue;
+
+                    QRect tileROI(QRect(tx * s, ty * s, s, s) & imageRect);
+                    QRect common(tileROI & roi);
+                    QRectF source(
+                        zoomF(common.left() - tileROI.left(), level),
+                        zoomF(common.top()  - tileROI.top(),  level),
+                        zoomF(common.width(), level),
+                        zoomF(common.height(), level));
+                    QRectF target(
+                        windowCoordinate(common.topLeft()),
+                        QSizeF(toZoomedF(common.width()),
+                               toZoomedF(common.height())));
+                    p.drawPixmap(target, *cached, source);
+                    found = true;
                 }
             }
         }
+        if(found)
+            return;
+    }
+
+    // placeholder until the tile is rendered:
+    p.fillRect(tileWindowRect(tileKey(position)),
+               QBrush(palette().color(QPalette::Mid), Qt::Dense6Pattern));
+}
+
+/****************************************************************/
+/*                                                              */
+/*                           prefetch                           */
+/*                                                              */
+/****************************************************************/
+
+// orders tile positions by the distance of their centers from a
+// point given in tile units
+struct QImageViewerTileDistanceLess
+{
+    QPointF center;
+
+    QImageViewerTileDistanceLess(QPointF const &c)
+    : center(c)
+    {}
+
+    qreal distance(QPoint const &position) const
+    {
+        QPointF d(QPointF(position) + QPointF(0.5, 0.5) - center);
+        return d.x() * d.x() + d.y() * d.y();
+    }
+
+    bool operator()(QPoint const &a, QPoint const &b) const
+    {
+        return distance(a) < distance(b);
+    }
+};
+
+void QImageViewer::setPrefetchBudget(int kiloBytes)
+{
+    prefetchBudget_ = std::max(0, kiloBytes);
+    if(!prefetchBudget_)
+    {
+        prefetchTimer_->stop();
+        prefetchQueue_.clear();
+    }
+}
+
+void QImageViewer::schedulePrefetch()
+{
+    // during playback, prefetched tiles would be obsolete with the
+    // next frame:
+    if(!prefetchBudget_ || imageSize_.isEmpty() || isPlaying())
+        return;
+
+    prefetchQueueValid_ = false;
+    prefetchTimer_->start();
+}
+
+QList<QImageViewerTileKey> QImageViewer::prefetchKeys() const
+{
+    QList<QImageViewerTileKey> result;
+    if(imageSize_.isEmpty())
+        return result;
+
+    // prefetched tiles must not evict the visible ones:
+    int budget = std::min(prefetchBudget_, tileCacheSize() / 2);
+    QRect cr(contentsRect());
+
+    // extrapolate the panning motion (the view moves opposite to
+    // the image), by at most two widget sizes:
+    QPointF ahead(panVelocity() * (-PrefetchLookahead / 1000.0));
+    ahead.setX(qBound(-2.0 * cr.width(), ahead.x(), 2.0 * cr.width()));
+    ahead.setY(qBound(-2.0 * cr.height(), ahead.y(), 2.0 * cr.height()));
+    QRect wanted((cr | cr.translated(ahead.toPoint())).adjusted(
+                     -TileSize / 2, -TileSize / 2, TileSize / 2, TileSize / 2));
+
+    QVector<QPoint> positions;
+    if(!directZoom())
+        positions = tilePositions(wanted);
+    QPointF center(zoomStep_
+                   ? toZoomedF(centerPixel_ + QPointF(0.5, 0.5)) / TileSize
+                   : (centerPixel_ + QPointF(0.5, 0.5))
+                     / tileSourceSize(zoomLevel_));
+    std::sort(positions.begin(), positions.end(),
+              QImageViewerTileDistanceLess(center));
+
+    QVector<QImageViewerTileKey> candidates;
+    foreach(QPoint const &position, positions)
+        candidates.append(tileKey(position));
+
+    // the visible part of the image at the neighboring zoom levels
+    // (for fractional zooms, including the nearest one):
+    QRect imageRect(QPoint(0, 0), imageSize_);
+    QRect visibleROI(imageCoordinates(cr) & imageRect);
+    int levels[] = { zoomLevel_, zoomLevel_ + 1, zoomLevel_ - 1 };
+    for(int i = zoomStep_ ? 0 : 1; i < 3 && !visibleROI.isEmpty(); ++i)
+    {
+        int level = levels[i];
+        if(level >= directZoomThreshold_ ||
+           zoom(originalWidth(), level) < 1 ||
+           zoom(originalHeight(), level) < 1)
+            continue;
+
+        int s = tileSourceSize(level);
+        positions.clear();
+        for(int ty = visibleROI.top() / s; ty <= visibleROI.bottom() / s; ++ty)
+            for(int tx = visibleROI.left() / s; tx <= visibleROI.right() / s; ++tx)
+                positions.append(QPoint(tx, ty));
+        std::sort(positions.begin(), positions.end(),
+                  QImageViewerTileDistanceLess(
+                      (centerPixel_ + QPointF(0.5, 0.5)) / s));
+
+        foreach(QPoint const &position, positions)
+            candidates.append(
+                QImageViewerTileKey(level, position.x(), position.y()));
+    }
+
+    foreach(QImageViewerTileKey const &key, candidates)
+    {
+        if(tiles_.contains(key))
+            continue;
+
+        QRect r(tileZoomedRect(key));
+        // (same cost as in cacheTile())
+        int cost = std::max(1, r.width() * r.height() * 4 / 1024);
+        if(cost > budget)
+            break;
+        budget -= cost;
+        result.append(key);
+    }
+    return result;
+}
+
+QImage QImageViewer::renderPrefetchTile(QImageViewerTileKey const &key)
+{
+    if(key.zoomLevel == zoomLevel_ && key.step == zoomStep_)
+        return renderTile(key);
+    if(key.step)
+        return QImage();
+
+    int level = pyramidLevel(key.zoomLevel);
+    return zoomRegion(pyramidImage(level), tileImageROI(key),
+                      key.zoomLevel, level);
+}
+
+void QImageViewer::prefetchNextTile()
+{
+    if(!isVisible() || !prefetchBudget_)
+    {
+        prefetchTimer_->stop();
+        return;
     }
-    else if(zoomLevel_ < 0)
+
+    if(!prefetchQueueValid_)
+    {
+        prefetchQueue_ = prefetchKeys();
+        prefetchQueueValid_ = true;
+    }
+
+    while(!prefetchQueue_.isEmpty())
     {
-        if(originalImage_.depth() <= 8)
+        QImageViewerTileKey key(prefetchQueue_.takeFirst());
+        if(pendingTiles_.contains(key) || cachedTile(key))
+            continue;
+
+        if(renderAsync())
         {
-            for(int y=0; y<h; ++y)
-            {
-                int yy = top + zoom(y, -zoomLevel_);
+            // collectRenderedTiles() puts the tile into the cache:
+            scheduleTile(key, true);
+            if(renderStatsEnabled_)
+                ++renderStats_.prefetchedTiles;
+            return;
+        }
 
-                uchar *d = dest.scanLine(y);
-                uchar *s = originalImage_.scanLine(yy) + left;
+        QImage zoomed(renderPrefetchTile(key));
+        if(zoomed.isNull())
+            continue;
 
-                for(int x=0; x<w; ++x, ++d)
-                {
-                    *d = s[zoom(x, -zoomLevel_)];
-                }
-            }
+        if(renderStatsEnabled_)
+            ++renderStats_.prefetchedTiles;
+        cacheTile(key, tilePixmap(zoomed));
+        QImageBufferPool::globalInstance()->recycle(zoomed);
+        return; // one tile per idle cycle, to stay responsive
+    }
+
+    prefetchTimer_->stop();
+}
+
+/****************************************************************/
+/*                                                              */
+/*                           playback                           */
+/*                                                              */
+/****************************************************************/
+
+QImageViewerFrameProvider::~QImageViewerFrameProvider()
+{
+}
+
+// provider playing a ring buffer of frames (see startPlayback())
+class QImageViewerFrameRing : public QImageViewerFrameProvider
+{
+  public:
+    QImageViewerFrameRing(QVector<QImage> const &frames)
+    : frames_(frames)
+    {}
+
+    virtual int frameCount() const
+    {
+        return frames_.size();
+    }
+
+    virtual QImage frame(int index)
+    {
+        return frames_[index];
+    }
+
+  private:
+    QVector<QImage> frames_;
+};
+
+void QImageViewer::showFrame(QImage const &frame)
+{
+    if(frame.isNull() || tileSource_ || externalImageData_ ||
+       frame.size() != originalImage_.size() ||
+       frame.format() != originalImage_.format())
+    {
+        setImage(frame, true);
+        return;
+    }
+
+    // (assigning only shares the frame's pixels)
+    nextImageGeneration();
+    {
+        QWriteLocker sourceLocker(&asyncState_->sourceLock);
+        originalImage_ = frame;
+    }
+
+    // queued updates are superseded by the new frame:
+    dropQueuedUpdates();
+
+    // update the (preallocated) pyramid levels:
+    QImageViewerBase::markDirty(QRect(QPoint(0, 0), imageSize_));
+
+    QVector<QPoint> positions;
+    if(!directZoom())
+        positions = tilePositions(contentsRect());
+
+    // the zoom buffers only grow when more tiles become visible (all
+    // tiles fit into TileSize x TileSize):
+    if(!frameBuffers_.isEmpty() && frameBuffers_[0].format() != frame.format())
+        frameBuffers_.clear();
+    while(frameBuffers_.size() < positions.size())
+    {
+        frameBuffers_.append(QImage(TileSize, TileSize, frame.format()));
+        if(renderStatsEnabled_)
+            renderStats_.allocatedBytes += frameBuffers_.last().byteCount();
+    }
+
+    // views of the buffers with the sizes of the visible tiles:
+    QVector<QImageViewerTileKey> keys;
+    QVector<QImage> views;
+    for(int i = 0; i < positions.size(); ++i)
+    {
+        QImageViewerTileKey key(tileKey(positions[i]));
+        QSize size(tileZoomedRect(key).size());
+        if(size.isEmpty())
+            continue;
+
+        QImage &buffer(frameBuffers_[i]);
+        QImage view(buffer.bits(), size.width(), size.height(),
+                    buffer.bytesPerLine(), buffer.format());
+        if(!frame.colorTable().isEmpty())
+            view.setColorTable(frame.colorTable());
+        keys.append(key);
+        views.append(view);
+    }
+
+    QVector<QImageViewerFrameTask> tasks(
+        std::min(renderThreadCount_, keys.size()));
+    for(int i = 0; i < keys.size(); ++i)
+    {
+        QImageViewerFrameTask &task(tasks[i % tasks.size()]);
+        task.viewer = this;
+        task.keys.append(keys[i]);
+        task.dests.append(&views[i]);
+    }
+    {
+        RenderTimer zoomTimer(renderStat(&QImageViewerRenderStats::zoomTime));
+        if(tasks.size() > 1)
+            runParallel(tasks);
+        else if(tasks.size() == 1)
+            tasks[0]();
+    }
+
+    // upload into the existing tile pixmaps, and discard all other
+    // tiles, which show the previous frame:
+    RenderTimer convertTimer(renderStat(&QImageViewerRenderStats::convertTime));
+    QSet<QImageViewerTileKey> visible;
+    for(int i = 0; i < keys.size(); ++i)
+    {
+        visible.insert(keys[i]);
+        QPixmap *pixmap = tiles_.object(keys[i]);
+        if(pixmap && pixmap->size() == views[i].size())
+        {
+            QPainter p(pixmap);
+            p.setCompositionMode(QPainter::CompositionMode_Source);
+            p.drawImage(0, 0, views[i]);
         }
         else
-        {
-            for(int y=0; y<h; ++y)
-            {
-                int yy = top + zoom(y, -zoomLevel_);
+            cacheTile(keys[i], tilePixmap(views[i]));
+    }
+    convertTimer.stop();
 
-                QRgb *d = (QRgb *)dest.scanLine(y);
-                QRgb *s = (QRgb *)originalImage_.scanLine(yy) + left;
+    foreach(QImageViewerTileKey key, tiles_.keys())
+        if(!visible.contains(key))
+            discardTile(key);
 
-                for(int x=0; x<w; ++x, ++d)
-                {
-                    *d = s[zoom(x, -zoomLevel_)];
-                }
-            }
-        }
+    update();
+}
+
+void QImageViewer::startPlayback(QVector<QImage> const &frames, qreal fps)
+{
+    // (stopping the previous playback releases the previous ring)
+    QSharedPointer<QImageViewerFrameProvider> ring(
+        new QImageViewerFrameRing(frames));
+    startPlayback(ring.data(), fps);
+    if(isPlaying())
+        frameRing_ = ring;
+}
+
+void QImageViewer::startPlayback(QImageViewerFrameProvider *provider,
+                                 qreal fps)
+{
+    stopPlayback();
+    if(!provider || fps <= 0)
+        return;
+
+    frameProvider_ = provider;
+    playbackFps_ = fps;
+    playbackCount_ = -1;
+    playbackFrame_ = 0;
+    droppedFrameCount_ = 0;
+
+    // poll at twice the frame rate, so that frames are displayed at
+    // most half a period late:
+    playbackTimer_->start(std::max(1, qRound(500 / fps)));
+    playbackClock_.start();
+    playNextFrame();
+}
+
+void QImageViewer::stopPlayback()
+{
+    playbackTimer_->stop();
+    frameProvider_ = 0;
+    frameRing_.clear();
+    frameBuffers_.clear();
+}
+
+void QImageViewer::playNextFrame()
+{
+    if(!frameProvider_)
+        return;
+
+    // frames are due at fixed times since startPlayback(), so that
+    // slow frames do not slow down playback:
+    int due = (int)(playbackClock_.elapsed() * playbackFps_ / 1000);
+    if(due <= playbackCount_)
+        return;
+
+    int dropped = due - playbackCount_ - 1;
+    droppedFrameCount_ += dropped;
+    playbackCount_ = due;
+
+    int count = frameProvider_->frameCount();
+    QImage frame;
+    if(count)
+        frame = frameProvider_->frame(count > 0 ? due % count : due);
+    if(frame.isNull())
+    {
+        stopPlayback();
+        return;
     }
+
+    showFrame(frame);
+    playbackFrame_ = count > 0 ? due % count : due;
+    emit frameDisplayed(playbackFrame_, dropped);
+}
+
+/****************************************************************/
+/*                                                              */
+/*                         render stats                         */
+/*                                                              */
+/****************************************************************/
+
+void QImageViewer::setRenderStatsEnabled(bool enabled)
+{
+    renderStatsEnabled_ = enabled;
+}
+
+void QImageViewer::resetRenderStats()
+{
+    renderStats_ = QImageViewerRenderStats();
+}
+
+void QImageViewer::paintFinished()
+{
+    if(!renderStatsEnabled_)
+        return;
+
+    ++renderStats_.paintCount;
+    emit renderStatsUpdated(renderStats_);
+}
+
+void QImageViewer::logRenderStats()
+{
+    const QImageViewerRenderStats &s(renderStats_);
+    if(!s.paintCount)
+        return;
+
+    qDebug("%s: %d paints, %.2f ms/paint (zoom %.2f ms, convert %.2f ms,"
+           " overlays %.2f ms), tiles: %d hits, %d misses, %d prefetched,"
+           " %lld kB allocated, %lld kB recycled",
+           qPrintable(objectName().isEmpty()
+                      ? QString(metaObject()->className()) : objectName()),
+           s.paintCount, s.paintTime / 1e6 / s.paintCount,
+           s.zoomTime / 1e6 / s.paintCount,
+           s.convertTime / 1e6 / s.paintCount,
+           s.overlayTime / 1e6 / s.paintCount,
+           s.tileHits, s.tileMisses, s.prefetchedTiles,
+           s.allocatedBytes / 1024, s.recycledBytes / 1024);
+    resetRenderStats();
+}
+
+/****************************************************************/
+/*                                                              */
+/*                          zoomedImage                         */
+/*                                                              */
+/****************************************************************/
+
+QImage QImageViewer::zoomRegion(QImage const &image, QRect const &imageROI,
+                                int zoomLevel, int sourceShift)
+{
+    if(imageROI.isEmpty())
+        return QImage();
+
+    QImage zoomed(QImageBufferPool::globalInstance()->image(
+                      QSize(zoom(imageROI.width(), zoomLevel),
+                            zoom(imageROI.height(), zoomLevel)),
+                      image.format(), image.colorTable()));
+    if(zoomed.isNull())
+        return QImage();
+
+    ImageZoom imageZoom(zoomLevel, imageROI.left(), zoomed.width(),
+                        image.width(),
+                        QImageFormatTraits::of(image.format()).zoomPixelSize,
+                        sourceShift);
+    imageZoom.zoomRows(image.bits(), image.bytesPerLine(), imageROI.top(),
+                       zoomed.bits(), zoomed.bytesPerLine(),
+                       0, zoomed.height());
+    return zoomed;
+}
+
+QImage QImageViewer::zoomedImage(QRect const &imageROI)
+{
+    if(imageROI.isEmpty())
+        return QImage();
+
+    QImage zoomed(QImageBufferPool::globalInstance()->image(
+                      QSize(zoom(imageROI.width(), zoomLevel_),
+                            zoom(imageROI.height(), zoomLevel_)),
+                      originalImage_.format(), originalImage_.colorTable()));
+    if(zoomed.isNull())
+        return QImage();
+
+    zoomImage(imageROI.left(), imageROI.top(), zoomed);
+
+    return zoomed;
+}
+
+QImage QImageViewer::scaleRegion(QImage const &image, QRect const &zoomedRect,
+                                 qreal zoomFactor, int sourceShift,
+                                 bool smooth)
+{
+    if(zoomedRect.isEmpty())
+        return QImage();
+
+    QImage zoomed(QImageBufferPool::globalInstance()->image(
+                      zoomedRect.size(), image.format(), image.colorTable()));
+    if(zoomed.isNull())
+        return QImage();
+
+    scaleRegionInto(image, zoomedRect, zoomFactor, sourceShift, smooth,
+                    zoomed);
+    return zoomed;
+}
+
+QImage QImageViewer::zoomRegion(QImageTileSource const &source,
+                                QRect const &imageROI,
+                                int zoomLevel, int sourceShift)
+{
+    if(imageROI.isEmpty())
+        return QImage();
+
+    // fetch the pixels needed (from the reduced level only when
+    // subsampling, as for pyramid levels):
+    int k = zoomLevel < 0 ? sourceShift : 0;
+    QRect levelROI(QPoint(imageROI.left() >> k, imageROI.top() >> k),
+                   QPoint(imageROI.right() >> k, imageROI.bottom() >> k));
+    QImage region(source.region(levelROI, k));
+    if(region.size() != levelROI.size())
+        return QImage();
+
+    // the region's origin is a multiple of 2^k original pixels, so
+    // that the same pixels are sampled as from the complete level:
+    QPoint origin(levelROI.topLeft() * (1 << k));
+    return zoomRegion(region, imageROI.translated(-origin), zoomLevel, k);
+}
+
+QImage QImageViewer::scaleRegion(QImageTileSource const &source,
+                                 QRect const &zoomedRect,
+                                 qreal zoomFactor, int sourceShift,
+                                 bool smooth)
+{
+    if(zoomedRect.isEmpty())
+        return QImage();
+
+    // fetch the pixels needed (with a margin for interpolation):
+    qint64 step = ImageZoom::fixedStep(zoomFactor);
+    int k = sourceShift;
+    QRect levelROI(
+        QPoint(ImageZoom::sourceCoordinate(step, zoomedRect.left()) >> k,
+               ImageZoom::sourceCoordinate(step, zoomedRect.top()) >> k),
+        QPoint(ImageZoom::sourceCoordinate(step, zoomedRect.right()) >> k,
+               ImageZoom::sourceCoordinate(step, zoomedRect.bottom()) >> k));
+    levelROI = levelROI.adjusted(-1, -1, 1, 1)
+        & QRect(QPoint(0, 0), source.levelSize(k));
+    if(levelROI.isEmpty())
+        return QImage();
+
+    QImage region(source.region(levelROI, k));
+    if(region.size() != levelROI.size())
+        return QImage();
+
+    // the region cannot be addressed by ImageZoom's coordinates of
+    // the complete image, so it is drawn by QPainter instead:
+    QImage zoomed(zoomedRect.size(), QImage::Format_ARGB32_Premultiplied);
+    if(zoomed.isNull())
+        return QImage();
+    zoomed.fill(0);
+
+    QPainter p(&zoomed);
+    p.setRenderHint(QPainter::SmoothPixmapTransform, smooth);
+    p.translate(-zoomedRect.left(), -zoomedRect.top());
+    p.scale(zoomFactor * (1 << k), zoomFactor * (1 << k));
+    p.drawImage(levelROI.topLeft(), region);
+    p.end();
+    return zoomed;
+}
+
+/****************************************************************/
+/*                                                              */
+/*                            zoomImage                         */
+/*                                                              */
+/****************************************************************/
+
+void QImageViewer::zoomImage(int left, int top, QImage & dest)
+{
+    int level = pyramidLevel(zoomLevel_);
+    const QImage &src = pyramidImage(level);
+    ImageZoom imageZoom(zoomLevel_, left, dest.width(), src.width(),
+                        QImageFormatTraits::of(src.format()).zoomPixelSize,
+                        level);
+
+    ZoomBandTask band;
+    band.imageZoom = &imageZoom;
+    band.srcBits = src.bits();
+    band.srcBytesPerLine = src.bytesPerLine();
+    band.top = top;
+    band.destBits = dest.bits();
+    band.destBytesPerLine = dest.bytesPerLine();
+
+    // split large images into row bands zoomed in parallel (unless
+    // we are already running in a worker thread):
+    int h = dest.height(), bands = 1;
+    if(renderThreadCount_ > 1 &&
+       dest.width() * h >= parallelThreshold_ &&
+       QThread::currentThread() == thread())
+        bands = std::min(renderThreadCount_, std::max(1, h / 16));
+
+    // let bands start at source row boundaries, so that
+    // ImageZoom::zoomRows() can copy repeated rows:
+    int f = std::max(1, zoomLevel_ + 1);
+    int bandHeight = ((h + bands - 1) / bands + f - 1) / f * f;
+
+    QVector<ZoomBandTask> tasks;
+    for(int y = 0; y < h; y += bandHeight)
+    {
+        band.beginRow = y;
+        band.endRow = std::min(h, y + bandHeight);
+        tasks.append(band);
+    }
+
+    if(tasks.size() > 1)
+        runParallel(tasks);
+    else if(tasks.size() == 1)
+        tasks[0]();
 }
 
 
@@ -943,13 +2643,15 @@ void QImageViewer::paintEvent(QPaintEvent *e)
     if(!isVisible())
         return;
 
-    QRect r = e->rect();
+    RenderTimer paintTimer(renderStat(&QImageViewerRenderStats::paintTime));
 
     QPainter p;
     p.begin(this);
 
-    p.save();
+    foreach(QRect const &r, paintRects(e))
     {
+        p.save();
+
         // we don't want to paint into the frame, but contentsRect()
         // is too small for some widget styles with round corners
         // and/or shadows (e.g. Oxygen):
@@ -959,12 +2661,17 @@ void QImageViewer::paintEvent(QPaintEvent *e)
 
         p.fillRect(r, palette().brush(backgroundRole()));
         paintImage(p, r);
+
+        p.restore();
     }
-    p.restore();
 
     drawFrame(&p);
 
     p.end();
+
+    paintTimer.stop();
+    paintFinished();
+    schedulePrefetch();
 }
 
 
@@ -976,18 +2683,77 @@ void QImageViewer::paintEvent(QPaintEvent *e)
 
 void QImageViewer::paintImage(QPainter &p, const QRect &r)
 {
-    if(originalImage_.isNull())
+    if(imageSize_.isEmpty())
         return;
 
-    checkDrawingPixmap();
+    if(directZoom())
+    {
+        paintImageDirectly(p, r);
+        return;
+    }
 
-    QRect drawROI(imageCoordinates(r));
+    QVector<QPoint> positions(tilePositions(r));
+    if(positions.isEmpty())
+        return;
 
-    QRect sourceRect(
-        QPoint(zoom(drawROI.left() - drawingPixmapDomain_.left(), zoomLevel_),
-               zoom(drawROI.top()  - drawingPixmapDomain_.top(),  zoomLevel_)),
-        QSize(zoom(drawROI.width(), zoomLevel_),
-              zoom(drawROI.height(), zoomLevel_)));
+    if(renderAsync())
+    {
+        {
+            QMutexLocker locker(&asyncState_->mutex);
+            asyncState_->wantedZoomLevel = zoomLevel_;
+            asyncState_->wantedZoomStep = zoomStep_;
+            asyncState_->wantedROI = imageCoordinates(contentsRect());
+        }
 
-    p.drawPixmap(windowCoordinate(drawROI.topLeft()), drawingPixmap_, sourceRect);
+        foreach(QPoint const &position, positions)
+        {
+            QImageViewerTileKey key(tileKey(position));
+            QPixmap *cached = cachedTile(key);
+            if(renderStatsEnabled_)
+                ++(cached ? renderStats_.tileHits : renderStats_.tileMisses);
+            if(cached)
+            {
+                p.drawPixmap(tileWindowRect(key).topLeft(), *cached);
+            }
+            else
+            {
+                scheduleTile(key);
+                paintTilePreview(p, position);
+            }
+        }
+        return;
+    }
+
+    QVector<QPixmap> pixmaps(tiles(positions));
+    for(int i = 0; i < positions.size(); ++i)
+    {
+        if(!pixmaps[i].isNull())
+            p.drawPixmap(tileWindowRect(tileKey(positions[i])).topLeft(),
+                         pixmaps[i]);
+    }
+}
+
+void QImageViewer::paintImageDirectly(QPainter &p, const QRect &r)
+{
+    QRect drawROI(imageCoordinates(r) &
+                  QRect(QPoint(0, 0), imageSize_));
+    if(drawROI.isEmpty())
+        return;
+
+    RenderTimer zoomTimer(renderStat(&QImageViewerRenderStats::zoomTime));
+
+    // copying the few visible pixels avoids that QPainter converts
+    // the complete image if its format is not supported natively:
+    QImage visible(tileSource_ ? tileSource_->region(drawROI)
+                               : originalImage_.copy(drawROI));
+    if(renderStatsEnabled_)
+        renderStats_.allocatedBytes += visible.byteCount();
+
+    p.save();
+    p.setRenderHint(QPainter::SmoothPixmapTransform,
+                    smoothZoom_ && zoomStep_ != 0);
+    p.translate(upperLeft_);
+    p.scale(zoomFactor_, zoomFactor_);
+    p.drawImage(drawROI.topLeft(), visible);
+    p.restore();
 }
@@ -27,16 +27,28 @@
 #define IMAGEVIEWER_HXX
 
 #include "vigraqt_export.hxx"
+#include <QCache>
+#include <QElapsedTimer>
 #include <QFrame>
 #include <QImage>
 #include <QKeyEvent>
+#include <QMetaType>
 #include <QMouseEvent>
 #include <QPaintEvent>
 #include <QPainter>
 #include <QPixmap>
 #include <QResizeEvent>
+#include <QSet>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVector>
 #include <math.h>
 
+class QReadWriteLock;
+class QImageTileSource;
+class QImageViewerGroup;
+struct QImageViewerAsyncState;
+
 /**
  * Image viewer base class managing coordinate transforms and user
  * interaction.  In particular, it has the following properties:
@@ -45,9 +57,10 @@
  * that each pixel is an (N+1)x(N+1) square and N<0 means that only
  * every (-N-1)th pixel in each dimension is displayed.
  *
- * 'zoomFactor' is a more convenient way of expressing the zoomLevel,
- * but only the few zoom factors expressible as integers or their
- * reciprocals are possible.
+ * 'zoomFactor' is a more convenient way of expressing the zoomLevel.
+ * By default, only the few zoom factors expressible as integers or
+ * their reciprocals are possible; with 'fractionalZoomEnabled', any
+ * factor can be set (and zoomLevel is the nearest zoom level).
  *
  * 'centerPixel' is the sub-pixel image coordinates of the widget center.
  * This coordinate is a fixpoint when zooming or resizing the
@@ -56,6 +69,14 @@
  * 'upperLeft' is the widget coordinate of the upper left image corner,
  * and depends on 'centerPixel', zoom level, and widget size.
  *
+ * 'pyramidEnabled' makes the viewer keep an image pyramid (built by
+ * averaging 2x2 blocks) for rendering negative zoom levels without
+ * aliasing.
+ *
+ * Images are kept in their own format; all formats of Qt 4 (from
+ * 1-bit masks to 32-bit color) are zoomed natively, see
+ * QImageFormatTraits.
+ *
  * TODO: describe user interaction
  */
 class VIGRAQT_EXPORT QImageViewerBase : public QFrame
@@ -63,6 +84,9 @@ class VIGRAQT_EXPORT QImageViewerBase : public QFrame
     Q_OBJECT
 
     Q_PROPERTY(int zoomLevel READ zoomLevel WRITE setZoomLevel)
+    Q_PROPERTY(qreal zoomFactor READ zoomFactor WRITE setZoomFactor)
+    Q_PROPERTY(bool fractionalZoomEnabled READ fractionalZoomEnabled WRITE setFractionalZoomEnabled)
+    Q_PROPERTY(bool pyramidEnabled READ pyramidEnabled WRITE setPyramidEnabled)
 
 public:
     QImageViewerBase(QWidget *parent = 0);
@@ -82,11 +106,104 @@ public Q_SLOTS:
          * Change a ROI of the displayed image.
          *
          * The given new roiImage will be placed into the
-         * originalImage() at the position given by upperLeft.
+         * originalImage() at the position given by upperLeft
+         * (converted to its format if necessary, and clipped to it).
          */
     virtual void updateROI(QImage const &roiImage, QPoint const &upperLeft);
 
+        /**
+         * Notify the viewer that the given ROI of the displayed image
+         * has changed (e.g. after writing into the buffer passed to
+         * setImageData()).  Only the affected part of the display
+         * (and of the image pyramid) is updated.
+         */
+    virtual void markDirty(QRect const &roi);
+
+        /**
+         * Like updateROI(), but only copies the pixel data
+         * immediately, while the display is updated later by
+         * postDirty().
+         */
+    void postROI(QImage const &roiImage, QPoint const &upperLeft);
+
+        /**
+         * Queue a markDirty() for the given ROI.  Queued ROIs are
+         * merged with overlapping ones and applied at most
+         * maxUpdateRate() times per second, which keeps the GUI
+         * responsive with live images producing many small updates.
+         */
+    void postDirty(QRect const &roi);
+
+        /**
+         * Apply all queued ROIs immediately.
+         */
+    void flushDirty();
+
 public:
+        /**
+         * Return the maximum number of times per second queued
+         * updates are applied (see postDirty()).
+         */
+    int maxUpdateRate() const
+        { return maxUpdateRate_; }
+
+        /**
+         * Set the maximum number of times per second queued updates
+         * are applied (default: 60).  0 means that they are applied
+         * as soon as control returns to the event loop.
+         */
+    void setMaxUpdateRate(int updatesPerSecond);
+
+        /**
+         * Return the number of queued ROIs that have been merged
+         * with overlapping ones (since the last
+         * resetUpdateCounters()).
+         */
+    int mergedUpdateCount() const
+        { return mergedUpdateCount_; }
+
+        /**
+         * Return the number of queued ROIs that have been dropped
+         * because they were contained in already queued ones (or
+         * have been superseded by setImage()).
+         */
+    int droppedUpdateCount() const
+        { return droppedUpdateCount_; }
+
+    void resetUpdateCounters();
+
+        /**
+         * Display the caller-owned pixel buffer 'data' (with the
+         * given size, bytesPerLine, and format) without copying it.
+         * Indexed images need a colorTable, too.  See setImage() for
+         * retainView.
+         *
+         * The buffer must stay valid until another image is set or
+         * the viewer is destroyed.  Changes of its contents are not
+         * noticed by the viewer and must be reported via
+         * markDirty().  (updateROI() writes into the buffer.)
+         */
+    virtual void setImageData(uchar *data, QSize const &size, int bytesPerLine,
+                              QImage::Format format,
+                              QVector<QRgb> const &colorTable = QVector<QRgb>(),
+                              bool retainView = false);
+
+        /**
+         * Return whether the displayed image is a caller-owned
+         * buffer (see setImageData()).
+         */
+    bool hasExternalImageData() const
+        { return externalImageData_; }
+
+        /**
+         * Return the lock to be write-locked while writing into the
+         * buffer passed to setImageData() (before markDirty()), or 0
+         * if no other threads read the image (QImageViewer's
+         * background jobs do).  It is also write-locked whenever the
+         * viewer changes its image.
+         */
+    virtual QReadWriteLock *imageLock();
+
         /**
          * Return a reference to the displayed image.
          */
@@ -97,13 +214,13 @@ public:
          * Return (unzoomed, original) width of displayed image.
          */
     int originalWidth() const
-        { return originalImage_.width(); }
+        { return imageSize_.width(); }
 
         /**
          * Return (unzoomed, original) height of displayed image.
          */
     int originalHeight() const
-        { return originalImage_.height(); }
+        { return imageSize_.height(); }
 
         /**
          * Return zoomed width of displayed image.
@@ -167,19 +284,83 @@ public:
 
         /**
          * Return multiplicative zoom factor (e.g. for QPainter::scale()).
-         * For instance, zoomFactor() == 1.0 iff zoomLevel() == 0.
+         * For instance, zoomFactor() == 1.0 iff zoomLevel() == 0
+         * (unless the zoom is fractional).
          */
-    inline qreal zoomFactor() const
-        { return zoomLevel() >= 0 ? 1 + zoomLevel() : 1./(1-zoomLevel()); }
+    qreal zoomFactor() const
+        { return zoomFactor_; }
 
         /**
-         * Compute and set the corresponding zoomLevel for nearest
-         * approximation of the given zoom factor (only integer
-         * factors and their reciprocals are actually supported in the
-         * current implementation).  See setZoomLevel().
+         * Set the zoom factor.  Unless fractionalZoomEnabled() is
+         * true, the nearest zoom level is used instead (see
+         * setZoomLevel()).
          */
     void setZoomFactor(qreal factor);
 
+        /**
+         * Returns whether the current zoomFactor() does not belong
+         * to an integer zoomLevel().
+         */
+    bool zoomIsFractional() const
+        { return zoomStep_ != 0; }
+
+        /**
+         * Returns whether arbitrary zoom factors are allowed
+         * (default: false).
+         */
+    bool fractionalZoomEnabled() const
+        { return fractionalZoomEnabled_; }
+
+        /**
+         * Returns whether an image pyramid is used for negative zoom
+         * levels (default: false).
+         */
+    bool pyramidEnabled() const
+        { return pyramidEnabled_; }
+
+        /**
+         * Returns the current panning velocity in widget pixels per
+         * second (i.e. how fast upperLeft() is moved by slideBy(),
+         * e.g. while the image is dragged with the mouse), smoothed
+         * over the last few slideBy() calls.  This is (0, 0) if the
+         * image has not been moved for PanVelocityTimeout ms.
+         */
+    QPointF panVelocity() const;
+
+    enum { PanVelocityTimeout = 200 };
+
+        /**
+         * Return the group this viewer belongs to, or 0 (see
+         * QImageViewerGroup::addViewer()).
+         */
+    QImageViewerGroup *group() const
+        { return group_; }
+
+public Q_SLOTS:
+        /**
+         * Enable or disable the image pyramid.  If enabled,
+         * setImage() computes reduced versions of the image (each
+         * half the size of the previous one, by averaging 2x2 blocks
+         * of 8-bit gray or 24/32-bit color pixels), which are kept
+         * up-to-date by updateROI().  Negative zoom levels are then
+         * rendered from the nearest pyramid level not smaller than
+         * the zoomed image, which reduces aliasing and the amount of
+         * data touched.  (Indexed images with a non-gray color table
+         * and formats with packed channels like RGB565 are subsampled
+         * instead of averaged; 1-bit images get no pyramid.)
+         */
+    virtual void setPyramidEnabled(bool enabled);
+
+        /**
+         * Allow arbitrary zoom factors.  If enabled, setZoomFactor()
+         * does not snap to zoom levels, autoZoom() fits the image
+         * exactly into the widget, and the mouse wheel zooms
+         * continuously.  Zoomed pixels show the image pixel under
+         * their center; QImageViewer can also interpolate bilinearly
+         * (see QImageViewer::setSmoothZoom()).
+         */
+    virtual void setFractionalZoomEnabled(bool enabled);
+
 public Q_SLOTS:
         /**
          * Position the pointer over the specified image pixel.
@@ -281,6 +462,13 @@ Q_SIGNALS:
 
     void imageChanged(); // FIXME: add ROI param
     void zoomLevelChanged(int zoomLevel);
+    void zoomFactorChanged(qreal zoomFactor);
+
+        /**
+         * Emitted whenever centerPixelF() changes (e.g. while
+         * panning).
+         */
+    void centerPixelChanged(QPointF const &centerPixel);
 
 protected:
     inline static int zoom(int value, int level)
@@ -290,12 +478,67 @@ protected:
     inline static QPointF zoomF(QPointF value, int level)
         { return QPointF(zoomF(value.x(), level), zoomF(value.y(), level)); }
 
+        // map distances from the image origin between image and
+        // zoomed coordinates according to the current zoom
+    double toZoomedF(double value) const;
+    QPointF toZoomedF(QPointF const &value) const;
+    double toImageF(double value) const;
+    QPointF toImageF(QPointF const &value) const;
+
+        // return the first zoomed coordinate showing the given image
+        // coordinate, and the image coordinate shown at the given
+        // zoomed coordinate, respectively
+    int toZoomed(int value) const;
+    int toImage(int value) const;
+
     inline QPointF widgetCenter() const;
     virtual bool setImagePosition(QPoint upperLeft, QPointF centerPixel);
     virtual void checkImagePosition();
 
+        // set the size of the displayed image (see setImage() for
+        // retainView) and adapt the view accordingly
+    void setImageSize(QSize const &size, bool retainView);
+
+        // repaint the widget after the image has been moved by
+        // offset by setImagePosition() (default: update())
+    virtual void scrollImage(QPoint const &offset);
+
     virtual void setCrosshairCursor();
 
+        // drop the updates queued by postDirty() (e.g. since the
+        // image has been replaced)
+    void dropQueuedUpdates();
+
+        // copy roiImage's pixels into originalImage_
+    void copyROI(QImage const &roiImage, QPoint const &upperLeft);
+
+        // return the pixel data of originalImage_ for writing
+        // (without detaching external image data)
+    uchar *originalImageBits();
+
+        // (re-)compute pyramid_ from originalImage_
+    void buildPyramid();
+
+        // recompute the part of pyramid_ affected by the given ROI
+        // of originalImage_
+    void updatePyramid(QRect const &roi);
+
+        // return the number of reduced levels available for
+        // rendering (default: pyramid_.size())
+    virtual int reducedLevelCount() const;
+
+        // return the pyramid level to be used for the given zoom
+        // level (0 means originalImage_)
+    int pyramidLevel(int zoomLevel) const;
+
+        // return the pyramid level to be used for the current
+        // (possibly fractional) zoom
+    int currentPyramidLevel() const;
+
+        // return the given pyramid level (0 means originalImage_)
+    const QImage &pyramidImage(int level) const
+        { return level > 0 ? pyramid_[level - 1] : originalImage_; }
+
     virtual void mouseMoveEvent(QMouseEvent *e);
     virtual void mousePressEvent(QMouseEvent *e);
     virtual void mouseReleaseEvent(QMouseEvent *e);
@@ -306,15 +549,36 @@ protected:
     virtual void showEvent(QShowEvent *e);
 
     QImage  originalImage_;
+    QSize   imageSize_; // size of the displayed image
+    bool    externalImageData_; // originalImage_ wraps a caller-owned buffer
     QPoint  upperLeft_; // position of image origin in widget coordinates
     QPointF centerPixel_; // sub-pixel image coordinates of widget center
-    int     zoomLevel_;
+    int     zoomLevel_; // (the nearest zoom level if fractional)
+    qreal   zoomFactor_;
+    qint64  zoomStep_; // fixed-point source step if fractional, or 0
+    bool    fractionalZoomEnabled_;
+    QVector<QImage> pyramid_; // levels 1..n (each half the size)
+    bool    pyramidEnabled_;
 
   private:
+    bool setZoom(int level, qreal factor);
+
     bool    inSlideState_;
     bool    pendingAutoZoom_;
     int     minAutoZoom_, maxAutoZoom_;
     QPoint  lastMousePosition_;
+
+    QPointF panVelocity_; // see panVelocity()
+    QElapsedTimer lastSlide_;
+
+    QImageViewerGroup *group_; // managed by the group
+    friend class QImageViewerGroup;
+
+    QVector<QRect> dirtyROIs_; // queued by postDirty()
+    QTimer *updateTimer_;
+    QElapsedTimer lastUpdate_;
+    int     maxUpdateRate_;
+    int     mergedUpdateCount_, droppedUpdateCount_;
 };
 
 QPoint QImageViewerBase::windowCoordinate(QPointF const & imagePoint) const
@@ -328,40 +592,692 @@ QPointF QImageViewerBase::widgetCenter() const
     return cr.topLeft() + QPointF(cr.width() / 2.0, cr.height() / 2.0);
 }
 
+/**
+ * Key of a zoomed tile in QImageViewer's tile cache.  Tiles are
+ * addressed by zoom level and tile column/row; see
+ * QImageViewer::tileImageROI() for the image region covered.  Tiles
+ * of fractional zoom factors additionally store the fixed-point
+ * step (see ImageZoom::fixedStep()), which is 0 otherwise.
+ */
+struct QImageViewerTileKey
+{
+    int zoomLevel, x, y;
+    qint64 step;
+
+    QImageViewerTileKey(int level, int tx, int ty, qint64 s = 0)
+    : zoomLevel(level), x(tx), y(ty), step(s)
+    {}
+
+    bool operator==(QImageViewerTileKey const &other) const
+    {
+        return zoomLevel == other.zoomLevel &&
+            x == other.x && y == other.y && step == other.step;
+    }
+};
+
+inline uint qHash(QImageViewerTileKey const &key)
+{
+    return ((uint)key.zoomLevel << 24) ^ ((uint)key.y << 12) ^ (uint)key.x
+        ^ (uint)key.step ^ (uint)(key.step >> 32);
+}
+
+/**
+ * Render statistics of a QImageViewer, accumulated since the last
+ * QImageViewer::resetRenderStats() (see
+ * QImageViewer::setRenderStatsEnabled()).  Times are wall-clock
+ * nanoseconds spent in the GUI thread; work done by background jobs
+ * in asyncRendering mode is not included in zoomTime.
+ */
+struct QImageViewerRenderStats
+{
+    int paintCount;         // number of paint events
+    qint64 paintTime;       // total time spent in paintEvent()
+    qint64 zoomTime;        // zooming tiles (renderTile(), zoomImage())
+    qint64 convertTime;     // converting new tiles to pixmaps
+    qint64 overlayTime;     // OverlayViewer::paintOverlays()
+    int tileHits;           // tiles found in the cache
+    int tileMisses;         // tiles that had to be rendered
+    int prefetchedTiles;    // tiles rendered ahead of time (idle)
+    qint64 allocatedBytes;  // tile pixmaps and other buffers allocated
+    qint64 recycledBytes;   // tile pixmaps reused instead
+
+    QImageViewerRenderStats()
+    : paintCount(0), paintTime(0), zoomTime(0), convertTime(0),
+      overlayTime(0), tileHits(0), tileMisses(0), prefetchedTiles(0),
+      allocatedBytes(0), recycledBytes(0)
+    {}
+};
+
+Q_DECLARE_METATYPE(QImageViewerRenderStats)
+
+/**
+ * Source of the frames of an image sequence played by
+ * QImageViewer::startPlayback() (e.g. a camera or a reader of
+ * time-lapse stacks).
+ */
+class VIGRAQT_EXPORT QImageViewerFrameProvider
+{
+  public:
+    virtual ~QImageViewerFrameProvider();
+
+        /**
+         * Return the number of frames, or -1 if it is unknown (e.g.
+         * for a live source).  Playback of a known number of frames
+         * loops.
+         */
+    virtual int frameCount() const = 0;
+
+        /**
+         * Return the frame with the given index (called in the GUI
+         * thread when the frame is due).  Returning a null image
+         * stops playback.  Frames with the size and format of the
+         * previous one are displayed without allocations; the
+         * provider may thus recycle a small ring of QImages (but
+         * must not change a frame while it is displayed).
+         */
+    virtual QImage frame(int index) = 0;
+};
+
+/**
+ * Image viewer displaying the zoomed image from a cache of
+ * pixmap tiles.
+ *
+ * Tiles are rendered on demand when they become visible and are kept
+ * in an LRU cache (keyed by zoom level and tile position) whose
+ * memory budget can be set with setTileCacheSize().  Thus, panning
+ * only zooms newly exposed tiles, and returning to a previous zoom
+ * level re-uses the tiles that are still cached.
+ *
+ * Missing tiles are zoomed in parallel on QThreadPool::globalInstance(),
+ * and large regions are split into row bands; see
+ * setRenderThreadCount() and setParallelThreshold().
+ *
+ * In asyncRendering mode, missing tiles are zoomed by background
+ * jobs instead, and a preview scaled from cached tiles of other zoom
+ * levels is painted until they are finished.  Jobs for tiles that
+ * are no longer visible (after zooming or panning) are skipped.
+ *
+ * With fractional zoom factors (see setFractionalZoomEnabled()),
+ * tiles are TileSize x TileSize squares of the zoomed image, resampled
+ * by scaleRegion() with nearest neighbor or (if smoothZoom is set)
+ * bilinear interpolation.
+ *
+ * From directZoomThreshold() on, the visible image pixels are painted
+ * as scaled rectangles instead, so that memory use does not grow with
+ * the zoom factor.
+ *
+ * While the event loop is idle, tiles that are likely to be needed
+ * next are rendered ahead of time: tiles in the direction the image
+ * is being dragged (see panVelocity()), tiles around the visible
+ * area, and (after zooming) the visible area at the neighboring zoom
+ * levels, within the memory budget set by setPrefetchBudget().
+ *
+ * Instead of a QImage, the viewer can also display a QImageTileSource
+ * (see setTileSource()), which is asked for the image regions needed
+ * by the visible tiles.  Then, tiles are always rendered in the
+ * background, and a placeholder is shown while they are loading.
+ *
+ * Viewers of the same QImageViewerGroup that display the same QImage
+ * share their zoomed tiles.
+ *
+ * Zoomed tiles are rendered into buffers taken from
+ * QImageBufferPool::globalInstance(), and the pixmaps of tiles
+ * discarded after image changes are reused for new tiles of the same
+ * size, so that zooming and updates cause little allocation churn.
+ *
+ * Image sequences can be played at a given frame rate with
+ * startPlayback(); frames of constant size and format are zoomed into
+ * preallocated buffers and uploaded into the visible tiles in place
+ * (see showFrame()).
+ *
+ * Render timings and tile cache counters can be collected with
+ * setRenderStatsEnabled().  Setting the environment variable
+ * VIGRAQT_RENDER_STATS to an interval in milliseconds enables them
+ * for all viewers and logs them periodically with qDebug().
+ */
 class VIGRAQT_EXPORT QImageViewer : public QImageViewerBase
 {
     Q_OBJECT
 
+    Q_PROPERTY(bool asyncRendering READ asyncRendering WRITE setAsyncRendering)
+    Q_PROPERTY(bool smoothZoom READ smoothZoom WRITE setSmoothZoom)
+    Q_PROPERTY(bool renderStatsEnabled READ renderStatsEnabled WRITE setRenderStatsEnabled)
+
 public:
+        /**
+         * Edge length of a (zoomed) tile in screen pixels.  (At high
+         * zoom levels, tiles may become slightly smaller since they
+         * always start at image pixel boundaries.)
+         */
+    enum { TileSize = 256 };
+
     QImageViewer(QWidget *parent = 0);
+    ~QImageViewer();
 
     virtual void setImage(QImage const &image, bool retainView= false);
-    virtual void updateROI(QImage const &roiImage, QPoint const &upperLeft);
+    virtual void markDirty(QRect const &roi);
 
-    virtual void slideBy(QPoint const &diff);
+        // (read-locked by the background jobs)
+    virtual QReadWriteLock *imageLock();
+
+        /**
+         * Like markDirty(), for pixels that were changed right
+         * before being painted anyway (e.g. computed lazily when they
+         * are scrolled into view): the cached tiles are patched
+         * without scheduling another repaint.
+         */
+    void markDirtyBeforePaint(QRect const &roi);
+
+        /**
+         * Display the image provided by source (of which the viewer
+         * takes ownership) instead of a QImage; see setImage() for
+         * retainView.  Regions are requested from source as they
+         * become visible, from background jobs (see
+         * asyncRendering()), and zoomed tiles are kept in the tile
+         * cache.  originalImage() is null while a tile source is
+         * displayed, and updateROI() does not apply; changes of the
+         * source's data have to be reported via markDirty() instead.
+         * Passing 0 removes the image; setImage() replaces the source.
+         */
+    virtual void setTileSource(QImageTileSource *source,
+                               bool retainView = false);
+
+        /**
+         * Return the displayed tile source, or 0 if a QImage is
+         * displayed.
+         */
+    QImageTileSource *tileSource() const
+        { return tileSource_.data(); }
+
+    virtual void setPyramidEnabled(bool enabled);
+
+        /**
+         * Returns whether missing tiles are rendered in the
+         * background (default: false).
+         */
+    bool asyncRendering() const
+        { return asyncRendering_; }
+
+        /**
+         * Enable or disable asynchronous rendering.  If enabled,
+         * repaints never wait for tiles to be zoomed; instead,
+         * missing tiles are zoomed by jobs on
+         * QThreadPool::globalInstance() and painted as soon as they
+         * are finished.  In the meantime, cached tiles of the
+         * nearest other zoom level are painted (scaled) as preview.
+         *
+         * Note that the background jobs always use the built-in zoom
+         * kernels (see zoomRegion()), not an overloaded zoomImage().
+         */
+    void setAsyncRendering(bool async);
+
+        /**
+         * Returns whether fractional zoom factors are rendered with
+         * bilinear interpolation (default: false).
+         */
+    bool smoothZoom() const
+        { return smoothZoom_; }
+
+        /**
+         * Enable or disable bilinear interpolation for fractional
+         * zoom factors (integer zoom levels always show square
+         * pixels).  This is only supported for 24/32-bit color and
+         * 8-bit gray images (see QImageFormatTraits::canInterpolate());
+         * other images are resampled with nearest neighbor
+         * interpolation.
+         */
+    void setSmoothZoom(bool smooth);
+
+        /**
+         * Zoom the given ROI of image by the given zoomLevel into a
+         * new image (with image's format and color table).  If image
+         * is a reduced pyramid level (whose pixels cover 2^k x 2^k
+         * original pixels), pass k as sourceShift and the ROI in
+         * original coordinates (for zoomLevel < 0 only).
+         *
+         * This function is reentrant and used for all zooming done
+         * outside of the GUI thread.
+         */
+    static QImage zoomRegion(QImage const &image, QRect const &imageROI,
+                             int zoomLevel, int sourceShift = 0);
+
+        /**
+         * Resample image by an arbitrary zoomFactor and return the
+         * given part of the zoomed image (e.g. QRect(0, 0, 100, 100)
+         * for its upper left 100x100 pixels).  sourceShift is the
+         * pyramid level of image (as for zoomRegion()).  If smooth
+         * is true, 24/32-bit color and 8-bit gray images are
+         * interpolated bilinearly.  This function is reentrant.
+         */
+    static QImage scaleRegion(QImage const &image, QRect const &zoomedRect,
+                              qreal zoomFactor, int sourceShift = 0,
+                              bool smooth = false);
+
+        /**
+         * Like zoomRegion() above, but fetches the pixels needed from
+         * source (from its reduced level sourceShift when
+         * subsampling).  This function is reentrant.
+         */
+    static QImage zoomRegion(QImageTileSource const &source,
+                             QRect const &imageROI,
+                             int zoomLevel, int sourceShift = 0);
+
+        /**
+         * Like scaleRegion() above, but fetches the pixels needed from
+         * source (from its reduced level sourceShift).  The result is
+         * resampled by QPainter and always has Format_ARGB32_Premultiplied.
+         * This function is reentrant.
+         */
+    static QImage scaleRegion(QImageTileSource const &source,
+                              QRect const &zoomedRect,
+                              qreal zoomFactor, int sourceShift = 0,
+                              bool smooth = false);
+
+        /**
+         * Return the memory budget of the tile cache in kilobytes.
+         */
+    int tileCacheSize() const
+        { return tiles_.maxCost(); }
+
+        /**
+         * Set the memory budget of the tile cache in kilobytes
+         * (default: 64MB).  When the budget is exceeded, the least
+         * recently used tiles are discarded.
+         */
+    void setTileCacheSize(int kiloBytes);
+
+        /**
+         * Return the maximum number of threads used for zooming.
+         */
+    int renderThreadCount() const
+        { return renderThreadCount_; }
+
+        /**
+         * Set the maximum number of threads used for zooming
+         * (default: QThread::idealThreadCount()).  A value of 1
+         * disables parallel rendering.
+         */
+    void setRenderThreadCount(int count);
+
+        /**
+         * Return the minimum number of zoomed pixels for which
+         * zoomImage() splits its work into parallel row bands.
+         */
+    int parallelThreshold() const
+        { return parallelThreshold_; }
+
+        /**
+         * Set the minimum number of zoomed pixels for which
+         * zoomImage() splits its work into parallel row bands
+         * (default: 512*512).  Smaller regions are zoomed serially.
+         */
+    void setParallelThreshold(int pixels);
+
+        /**
+         * Return the zoom level from which on the image is painted
+         * directly instead of from zoomed tiles.
+         */
+    int directZoomThreshold() const
+        { return directZoomThreshold_; }
+
+        /**
+         * Set the zoom level from which on the visible image pixels
+         * are painted directly by QPainter (as scaled rectangles,
+         * without interpolation unless smoothZoom() is set for
+         * fractional zooms) instead of being zoomed into tiles
+         * (default: 16, i.e. 17x magnification).  At such zoom
+         * levels, only few image pixels are visible, while zoomed
+         * tiles would need (N+1)^2 times their memory.  Fractional
+         * zooms are painted directly if their nearest zoom level is
+         * not below the threshold.  Note that an overloaded
+         * zoomImage() is not used for direct painting.
+         */
+    void setDirectZoomThreshold(int level);
+
+        /**
+         * Return the memory budget for prefetched tiles in kilobytes.
+         */
+    int prefetchBudget() const
+        { return prefetchBudget_; }
+
+        /**
+         * Set the memory budget for tiles rendered ahead of time in
+         * kilobytes (default: 16MB); 0 disables prefetching.  At
+         * most half of the tileCacheSize() is used for prefetching,
+         * so that prefetched tiles do not evict the visible ones.
+         *
+         * Tiles are prefetched one at a time in the GUI thread when
+         * it is idle.  Tiles of other zoom levels are zoomed with
+         * zoomRegion(), not with an overloaded zoomImage().
+         */
+    void setPrefetchBudget(int kiloBytes);
+
+        /**
+         * Time in milliseconds the panning motion is extrapolated
+         * for choosing the tiles to be prefetched.
+         */
+    enum { PrefetchLookahead = 500 };
+
+        /**
+         * Returns whether render statistics are collected (default:
+         * false, unless VIGRAQT_RENDER_STATS is set).
+         */
+    bool renderStatsEnabled() const
+        { return renderStatsEnabled_; }
+
+        /**
+         * Enable or disable collecting render statistics.  When
+         * disabled, the instrumentation costs only a few branches
+         * per paint event.
+         */
+    void setRenderStatsEnabled(bool enabled);
+
+        /**
+         * Return the render statistics collected so far.
+         */
+    QImageViewerRenderStats const &renderStats() const
+        { return renderStats_; }
+
+        /**
+         * Reset the render statistics to zero.
+         */
+    void resetRenderStats();
+
+        /**
+         * Display frame in place of the current image.  If it has the
+         * size and format of the current image, no relayout happens,
+         * and the visible tiles are re-zoomed (in parallel) into
+         * preallocated buffers and uploaded into their existing
+         * pixmaps, i.e. without allocating images or pixmaps (cached
+         * tiles that are not visible are discarded).  Otherwise, this
+         * is equivalent to setImage(frame, true).
+         */
+    void showFrame(QImage const &frame);
+
+        /**
+         * Play the given ring buffer of (equally sized) frames in a
+         * loop at fps frames per second, starting with frames[0].
+         * Frames that are due while the previous one is still being
+         * displayed are skipped (see droppedFrameCount()).
+         */
+    void startPlayback(QVector<QImage> const &frames, qreal fps = 25);
+
+        /**
+         * Play the frames of provider (which is not owned by the
+         * viewer and must stay valid until stopPlayback()) at fps
+         * frames per second.
+         */
+    void startPlayback(QImageViewerFrameProvider *provider, qreal fps = 25);
+
+        /**
+         * Returns whether an image sequence is being played.
+         */
+    bool isPlaying() const
+        { return frameProvider_ != 0; }
+
+        /**
+         * Return the index of the displayed frame of the sequence.
+         */
+    int playbackFrame() const
+        { return playbackFrame_; }
+
+        /**
+         * Return the number of frames skipped since startPlayback()
+         * because displaying the previous frames took too long.
+         */
+    int droppedFrameCount() const
+        { return droppedFrameCount_; }
+
+public Q_SLOTS:
+        /**
+         * Stop playback, leaving the current frame displayed.
+         */
+    void stopPlayback();
+
+Q_SIGNALS:
+        /**
+         * Emitted after every paint event while render statistics
+         * are enabled.
+         */
+    void renderStatsUpdated(QImageViewerRenderStats const &stats);
+
+        /**
+         * Emitted during playback whenever a frame has been displayed;
+         * dropped is the number of frames skipped before it.
+         */
+    void frameDisplayed(int index, int dropped);
 
 protected Q_SLOTS:
-    virtual void createDrawingPixmap();
+        /**
+         * Discard all cached tiles (e.g. after the image changed).
+         */
+    virtual void clearTileCache();
+
+        /**
+         * Put the tiles finished by background jobs into the cache
+         * and repaint them.
+         */
+    void collectRenderedTiles();
+
+        /**
+         * Render and cache the next tile to be prefetched (called
+         * whenever the event loop is idle).
+         */
+    void prefetchNextTile();
+
+        /**
+         * Print the render statistics with qDebug() and reset them
+         * (called periodically if VIGRAQT_RENDER_STATS is set).
+         */
+    void logRenderStats();
+
+        // display the frame that is due (called periodically during
+        // playback)
+    void playNextFrame();
 
 protected:
-        // return ROI of originalImage_ which should be buffered in
-        // drawingPixmap_
-    QRect cachedImageROI();
+        // adds the time until stop() or destruction to *total (if
+        // total is not 0, i.e. if render statistics are enabled)
+    class RenderTimer
+    {
+      public:
+        RenderTimer(qint64 *total)
+        : total_(total)
+        {
+            if(total_)
+                timer_.start();
+        }
 
-    void checkDrawingPixmap();
+        ~RenderTimer()
+        {
+            stop();
+        }
 
-    virtual bool setImagePosition(QPoint upperLeft, QPointF centerPixel);
+        void stop()
+        {
+            if(total_)
+                *total_ += timer_.nsecsElapsed();
+            total_ = 0;
+        }
+
+      private:
+        qint64 *total_;
+        QElapsedTimer timer_;
+    };
+
+        // return the given render statistics counter if statistics
+        // are enabled, or 0 (for RenderTimer)
+    qint64 *renderStat(qint64 QImageViewerRenderStats::*stat)
+        { return renderStatsEnabled_ ? &(renderStats_.*stat) : 0; }
+
+        // count a finished paint event and emit renderStatsUpdated()
+    void paintFinished();
+
+        // return number of image pixels (in each dimension) covered
+        // by one tile at the given zoom level
+    static int tileSourceSize(int zoomLevel);
+
+        // return the key of the given tile of the current zoom
+    QImageViewerTileKey tileKey(QPoint const &position) const;
+
+        // return ROI of originalImage_ covered by the given tile
+        // (cropped to the image)
+    QRect tileImageROI(QImageViewerTileKey const &key) const;
+
+        // return the part of the zoomed image covered by the given
+        // tile, and its position in the window (for tiles of the
+        // current zoom only)
+    QRect tileZoomedRect(QImageViewerTileKey const &key) const;
+    QRect tileWindowRect(QImageViewerTileKey const &key) const;
+
+        // zoom the given tile of the current zoom (called from worker
+        // threads, too)
+    QImage renderTile(QImageViewerTileKey const &key);
+
+        // zoom the given tile of the current zoom of originalImage_
+        // into dest, which has the tile's size (called from worker
+        // threads, too)
+    void renderTileInto(QImageViewerTileKey const &key, QImage &dest);
+
+        // returns whether the current zoom is painted directly (see
+        // setDirectZoomThreshold())
+    bool directZoom() const
+        { return zoomLevel_ >= directZoomThreshold_; }
+
+        // paint the image pixels visible in r as scaled rectangles
+    void paintImageDirectly(QPainter &p, const QRect &r);
+
+        // return the positions of the tiles of the current zoom
+        // intersecting the given window rect
+    QVector<QPoint> tilePositions(QRect const &windowRect) const;
+
+        // return the keys of the tiles to be prefetched, most urgent
+        // first, within the prefetch budget (only tiles not cached)
+    QList<QImageViewerTileKey> prefetchKeys() const;
+
+        // zoom the given tile of the current or another zoom level
+    QImage renderPrefetchTile(QImageViewerTileKey const &key);
+
+        // recompute the tiles to be prefetched when the event loop is
+        // idle next (called after painting, i.e. after any change of
+        // the view)
+    void schedulePrefetch();
+
+        // return the cached tile with the given key, or 0; missing
+        // tiles are taken from viewers of the same group showing the
+        // same image (see sharesTilesWith())
+    QPixmap *cachedTile(QImageViewerTileKey const &key);
+
+        // returns whether other renders the same tiles as this
+        // viewer (same image data, class, and rendering options)
+    bool sharesTilesWith(QImageViewer const &other) const;
+
+        // return the given tiles of the current zoom, rendering (in
+        // parallel) and caching them if necessary
+    QVector<QPixmap> tiles(QVector<QPoint> const &positions);
+
+        // increment imageGeneration_, making cached tiles and
+        // background jobs for the previous image data obsolete
+    void nextImageGeneration();
+
+        // patch or discard the cached tiles showing the given ROI of
+        // the image; returns the window rect to be repainted
+    QRect updateCachedTiles(QRect const &roi);
+
+        // drop the results of pending background jobs whose tiles
+        // show the given ROI of the image (instead of those of all
+        // jobs, as nextImageGeneration() does)
+    void outdatePendingTiles(QRect const &roi);
+
+        // put the given tile into the cache
+    void cacheTile(QImageViewerTileKey const &key, QPixmap const &pixmap);
+
+        // remove the given tile from the cache, keeping its pixmap
+        // for reuse by tilePixmap()
+    void discardTile(QImageViewerTileKey const &key);
+
+        // convert zoomed into a tile pixmap, reusing a discarded
+        // pixmap of the same size if possible
+    QPixmap tilePixmap(QImage const &zoomed);
+
+        // returns whether missing tiles are rendered by background
+        // jobs (with asyncRendering() or a tile source)
+    bool renderAsync() const
+        { return asyncRendering_ || tileSource_; }
+
+        // start a background job for the given tile (unless already
+        // pending); prefetch jobs run with lower priority and are not
+        // skipped when the tile is not visible
+    void scheduleTile(QImageViewerTileKey const &key, bool prefetch = false);
+
+        // paint a preview of the given tile from cached tiles of
+        // other zoom levels (or a placeholder if there are none)
+    void paintTilePreview(QPainter &p, QPoint const &position);
+
+        // the reduced levels of the tile source, if any
+    virtual int reducedLevelCount() const;
+
+        // zoom the given ROI of originalImage_ into a new image
+        // (called from worker threads, too)
+    QImage zoomedImage(QRect const &imageROI);
+
+        // scroll the widget contents, so that only the exposed strips
+        // have to be repainted
+    virtual void scrollImage(QPoint const &offset);
+
+        // return the rects of e's region to be painted separately
+        // (avoids repainting the large bounding rect of e.g. the two
+        // strips exposed by diagonal scrolling)
+    static QVector<QRect> paintRects(QPaintEvent *e);
 
         // zoom originalImage_ from pixel pos (left, top) into dest
         // (the source ROI's size depends on dest.size() and the
-        // zoomFactor())
+        // zoomFactor()); must be reentrant, since tiles are zoomed
+        // in parallel.  Only used for integer zoom levels.
     virtual void zoomImage(int left, int top, QImage &dest);
 
     virtual void paintEvent(QPaintEvent *);
     virtual void paintImage(QPainter &p, const QRect &r);
 
-    QPixmap drawingPixmap_;
-    QRect drawingPixmapDomain_;
+    QCache<QImageViewerTileKey, QPixmap> tiles_;
+        // pixmaps of discarded tiles (see discardTile()), and their
+        // cost in kilobytes (limited to a quarter of the tile cache):
+    QList<QPixmap> sparePixmaps_;
+    int sparePixmapCost_;
+    int renderThreadCount_, parallelThreshold_;
+
+    bool asyncRendering_, smoothZoom_;
+    int directZoomThreshold_;
+    QSharedPointer<QImageTileSource> tileSource_;
+        // state shared with the background jobs:
+    QSharedPointer<QImageViewerAsyncState> asyncState_;
+    QSet<QImageViewerTileKey> pendingTiles_;
+        // pending tiles whose results are outdated by markDirty():
+    QSet<QImageViewerTileKey> outdatedTiles_;
+        // incremented whenever cached tiles become invalid:
+    int imageGeneration_;
+
+    int prefetchBudget_;
+    QTimer *prefetchTimer_; // zero-interval timer while prefetching
+    QList<QImageViewerTileKey> prefetchQueue_;
+    bool prefetchQueueValid_;
+
+    QImageViewerFrameProvider *frameProvider_; // 0 unless playing
+    QSharedPointer<QImageViewerFrameProvider> frameRing_;
+    QTimer *playbackTimer_;
+    QElapsedTimer playbackClock_;
+    qreal playbackFps_;
+    int playbackCount_, playbackFrame_, droppedFrameCount_;
+        // TileSize x TileSize zoom buffers of showFrame(), which are
+        // uploaded into the (front) tile pixmaps:
+    QVector<QImage> frameBuffers_;
+
+    bool renderStatsEnabled_;
+    QImageViewerRenderStats renderStats_;
+
+    friend struct QImageViewerTileTask;
+    friend struct QImageViewerFrameTask;
+    friend class AsyncTileJob;
 };
 
 #endif /* IMAGEVIEWER_HXX */
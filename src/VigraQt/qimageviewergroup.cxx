@@ -0,0 +1,109 @@
+#include "qimageviewergroup.hxx"
+#include "qimageviewer.hxx"
+
+QImageViewerGroup::QImageViewerGroup(QObject *parent)
+: QObject(parent),
+  tileSharingEnabled_(true),
+  synchronizing_(false)
+{
+}
+
+QImageViewerGroup::~QImageViewerGroup()
+{
+    foreach(QImageViewerBase *viewer, viewers_)
+        viewer->group_ = 0;
+}
+
+void QImageViewerGroup::addViewer(QImageViewerBase *viewer)
+{
+    if(!viewer || viewer->group_ == this)
+        return;
+
+    if(viewer->group_)
+        viewer->group_->removeViewer(viewer);
+
+    if(!viewers_.isEmpty())
+    {
+        QImageViewerBase *first = viewers_.first();
+        QPointF centerPixel(first->centerPixelF());
+        synchronizing_ = true;
+        viewer->setZoomFactor(first->zoomFactor());
+        viewer->setCenterPixel(centerPixel);
+        synchronizing_ = false;
+    }
+
+    viewers_.append(viewer);
+    viewer->group_ = this;
+
+    connect(viewer, SIGNAL(zoomFactorChanged(qreal)),
+            SLOT(viewerZoomed(qreal)));
+    connect(viewer, SIGNAL(centerPixelChanged(QPointF const &)),
+            SLOT(viewerMoved(QPointF const &)));
+    connect(viewer, SIGNAL(destroyed(QObject *)),
+            SLOT(viewerDestroyed(QObject *)));
+}
+
+void QImageViewerGroup::removeViewer(QImageViewerBase *viewer)
+{
+    if(!viewer || viewer->group_ != this)
+        return;
+
+    viewers_.removeAll(viewer);
+    viewer->group_ = 0;
+    disconnect(viewer, 0, this, 0);
+}
+
+void QImageViewerGroup::setTileSharingEnabled(bool enabled)
+{
+    tileSharingEnabled_ = enabled;
+}
+
+void QImageViewerGroup::setZoomFactor(qreal factor)
+{
+    synchronize(0, factor, 0);
+}
+
+void QImageViewerGroup::setCenterPixel(QPointF const &centerPixel)
+{
+    synchronize(0, 0, &centerPixel);
+}
+
+void QImageViewerGroup::viewerZoomed(qreal factor)
+{
+    if(!synchronizing_)
+        synchronize(qobject_cast<QImageViewerBase *>(sender()), factor, 0);
+}
+
+void QImageViewerGroup::viewerMoved(QPointF const &centerPixel)
+{
+    if(!synchronizing_)
+        synchronize(qobject_cast<QImageViewerBase *>(sender()), 0,
+                    &centerPixel);
+}
+
+void QImageViewerGroup::viewerDestroyed(QObject *viewer)
+{
+    // (the viewer is already destroyed down to QObject)
+    for(int i = viewers_.size() - 1; i >= 0; --i)
+        if(static_cast<QObject *>(viewers_[i]) == viewer)
+            viewers_.removeAt(i);
+}
+
+void QImageViewerGroup::synchronize(QImageViewerBase *except,
+                                    qreal factor, QPointF const *centerPixel)
+{
+    // (centerPixel may refer to a member's state, which changes)
+    QPointF center(centerPixel ? *centerPixel : QPointF());
+
+    synchronizing_ = true;
+    foreach(QImageViewerBase *viewer, viewers_)
+    {
+        if(viewer == except)
+            continue;
+        if(factor > 0)
+            viewer->setZoomFactor(factor);
+        if(centerPixel)
+            viewer->setCenterPixel(center);
+    }
+    synchronizing_ = false;
+}
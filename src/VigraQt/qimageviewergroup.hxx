@@ -0,0 +1,97 @@
+#ifndef QIMAGEVIEWERGROUP_HXX
+#define QIMAGEVIEWERGROUP_HXX
+
+#include "vigraqt_export.hxx"
+#include <QList>
+#include <QObject>
+#include <QPointF>
+
+class QImageViewerBase;
+
+/**
+ * Group of linked image viewers, e.g. for comparing several
+ * processing stages side by side.
+ *
+ * Whenever the zoom factor or the center pixel of a member changes
+ * (by user interaction or programmatically), the group applies it to
+ * all other members.  Since this happens immediately, Qt repaints
+ * all members in the same frame, and each of them only repaints the
+ * strips exposed by panning.
+ *
+ * Member QImageViewers that display the same QImage (i.e. copies of
+ * one QImage object, with the same rendering options) also share
+ * their zoomed tiles, so that each tile is rendered only once for all
+ * of them.  Note that such viewers have to be notified of changes of
+ * the image alike (e.g. via markDirty()), since each of them only
+ * updates its own tiles.
+ *
+ * A viewer can only be a member of one group; the group does not own
+ * its members.
+ */
+class VIGRAQT_EXPORT QImageViewerGroup : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool tileSharingEnabled READ tileSharingEnabled WRITE setTileSharingEnabled)
+
+public:
+    QImageViewerGroup(QObject *parent = 0);
+    ~QImageViewerGroup();
+
+        /**
+         * Add viewer to the group (removing it from its previous
+         * group, if any).  The viewer adopts the zoom factor and
+         * center pixel of the first member.
+         */
+    void addViewer(QImageViewerBase *viewer);
+
+        /**
+         * Remove viewer from the group.  (Destroyed viewers are
+         * removed automatically.)
+         */
+    void removeViewer(QImageViewerBase *viewer);
+
+        /**
+         * Return the members of the group.
+         */
+    QList<QImageViewerBase *> viewers() const
+        { return viewers_; }
+
+        /**
+         * Returns whether members displaying the same image share
+         * their tiles (default: true).
+         */
+    bool tileSharingEnabled() const
+        { return tileSharingEnabled_; }
+
+    void setTileSharingEnabled(bool enabled);
+
+public Q_SLOTS:
+        /**
+         * Set the zoom factor of all members.
+         */
+    void setZoomFactor(qreal factor);
+
+        /**
+         * Set the center pixel of all members.
+         */
+    void setCenterPixel(QPointF const &centerPixel);
+
+protected Q_SLOTS:
+    void viewerZoomed(qreal factor);
+    void viewerMoved(QPointF const &centerPixel);
+    void viewerDestroyed(QObject *viewer);
+
+protected:
+        // apply the given zoom factor and/or center pixel to all
+        // members except 'except'
+    void synchronize(QImageViewerBase *except,
+                     qreal factor, QPointF const *centerPixel);
+
+private:
+    QList<QImageViewerBase *> viewers_;
+    bool tileSharingEnabled_;
+    bool synchronizing_; // prevents recursion via the members' signals
+};
+
+#endif // QIMAGEVIEWERGROUP_HXX
@@ -0,0 +1,135 @@
+#include "qimageviewrenderer.hxx"
+#include "qimagebufferpool.hxx"
+#include "qimageformattraits.hxx"
+#include <QPainter>
+#include <algorithm>
+
+QImageViewRenderer::QImageViewRenderer(QImage const &image)
+: zoomLevel_(0),
+  background_(Qt::darkGray)
+{
+    setImage(image);
+}
+
+void QImageViewRenderer::setImage(QImage const &image)
+{
+    // (same conversion as in QImageViewerBase::setImage())
+    if(image.isNull() || QImageFormatTraits::of(image.format()).isSupported())
+        image_ = image;
+    else
+        image_ = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    centerPixel_ = QPointF(image_.width() / 2.0, image_.height() / 2.0);
+}
+
+void QImageViewRenderer::setZoomLevel(int level)
+{
+    zoomLevel_ = level;
+}
+
+void QImageViewRenderer::setCenterPixel(QPointF const &centerPixel)
+{
+    centerPixel_ = centerPixel;
+}
+
+void QImageViewRenderer::setBackground(QBrush const &brush)
+{
+    background_ = brush;
+}
+
+void QImageViewRenderer::addOverlay(Overlay *o)
+{
+    overlays_.push_back(o);
+}
+
+void QImageViewRenderer::removeOverlay(Overlay *o)
+{
+    OverlayViewer::Overlays::iterator it =
+        std::find(overlays_.begin(), overlays_.end(), o);
+    if(it != overlays_.end())
+        overlays_.erase(it);
+}
+
+// zoom value by the given zoom level (as QImageViewerBase::zoom())
+static int zoom(int value, int level)
+{
+    return level >= 0 ? value * (level + 1) : value / (1 - level);
+}
+
+// return the zoom factor of the given zoom level
+static qreal zoomFactor(int level)
+{
+    return level >= 0 ? level + 1 : 1.0 / (1 - level);
+}
+
+QPoint QImageViewRenderer::upperLeft(QSize const &viewportSize) const
+{
+    // (as in QImageViewerBase::setCenterPixel())
+    QPointF viewportCenter(viewportSize.width() / 2.0,
+                           viewportSize.height() / 2.0);
+    return (viewportCenter - centerPixel_ * zoomFactor(zoomLevel_)).toPoint();
+}
+
+void QImageViewRenderer::render(QPainter &p, QRect const &viewport) const
+{
+    p.save();
+    p.setClipRect(viewport);
+    p.translate(viewport.topLeft());
+
+    QRect r(QPoint(0, 0), viewport.size());
+    p.fillRect(r, background_);
+
+    QPoint ul(upperLeft(viewport.size()));
+    int level = zoomLevel_;
+
+    // zoom the visible image pixels (if subsampling, all pixels of
+    // the visible zoomed pixels):
+    QRect zoomedImageRect(0, 0, zoom(image_.width(), level),
+                          zoom(image_.height(), level));
+    QRect visible(r.translated(-ul) & zoomedImageRect);
+    if(!visible.isEmpty())
+    {
+        QRect imageROI(
+            QPoint(zoom(visible.left(), -level), zoom(visible.top(), -level)),
+            level >= 0
+            ? QPoint(zoom(visible.right(), -level),
+                     zoom(visible.bottom(), -level))
+            : QPoint(zoom(visible.right() + 1, -level) - 1,
+                     zoom(visible.bottom() + 1, -level) - 1));
+        imageROI &= image_.rect();
+
+        QImage zoomed(QImageViewer::zoomRegion(image_, imageROI, level));
+        p.drawImage(ul + QPoint(zoom(imageROI.left(), level),
+                                zoom(imageROI.top(), level)),
+                    zoomed);
+        QImageBufferPool::globalInstance()->recycle(zoomed);
+    }
+
+    // (render() is const and may run in several threads, so the
+    // overlays are sorted in a copy; those of a viewer are skipped)
+    OverlayViewer::Overlays overlays;
+    foreach(Overlay *overlay, overlays_)
+        if(!overlay->viewer())
+            overlays.push_back(overlay);
+    OverlayViewer::sortOverlays(overlays);
+    foreach(Overlay *overlay, overlays)
+        overlay->setZoomLevel(level);
+    OverlayViewer::drawOverlays(p, r, overlays, ul, zoomFactor(level));
+
+    p.restore();
+}
+
+void QImageViewRenderer::render(QImage &target) const
+{
+    QPainter p(&target);
+    render(p, target.rect());
+}
+
+QImage QImageViewRenderer::render(QSize const &size,
+                                  QImage::Format format) const
+{
+    QImage result(size, format);
+    if(!result.isNull())
+        render(result);
+    return result;
+}
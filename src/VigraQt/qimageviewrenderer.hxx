@@ -0,0 +1,111 @@
+#ifndef QIMAGEVIEWRENDERER_HXX
+#define QIMAGEVIEWRENDERER_HXX
+
+#include "overlayviewer.hxx"
+#include "vigraqt_export.hxx"
+#include <QBrush>
+#include <QImage>
+#include <QPointF>
+
+/**
+ * Widget-free renderer of the view of an OverlayViewer, e.g. for
+ * generating annotated thumbnails in batch jobs.
+ *
+ * Given an image, a zoom level, a center pixel, and overlays,
+ * render() paints what an OverlayViewer of the target's size would
+ * show (without its frame), zoomed by the same kernels as
+ * QImageViewer::zoomRegion().  Negative zoom levels subsample the
+ * image like a viewer with disabled image pyramid.
+ *
+ * No QWidget or QPixmap is involved, so renderers can be used in
+ * worker threads (e.g. one per QtConcurrent task) without a display.
+ * Before drawing, the overlays are told the zoom level via
+ * Overlay::setZoomLevel(); thus, threads rendering concurrently need
+ * their own overlay objects if that function changes the overlay's
+ * state (e.g. for EdgeOverlay).  Overlays that have been added to an
+ * OverlayViewer (see Overlay::viewer()) are not drawn, since they may
+ * query the viewer (like ImageCursor) and are used by it at the same
+ * time; the renderer needs overlay objects of its own.
+ */
+class VIGRAQT_EXPORT QImageViewRenderer
+{
+  public:
+    QImageViewRenderer(QImage const &image = QImage());
+
+    QImage image() const
+        { return image_; }
+
+        /**
+         * Set the image to be rendered, and center it.
+         */
+    void setImage(QImage const &image);
+
+    int zoomLevel() const
+        { return zoomLevel_; }
+
+        /**
+         * Set the zoom level (as in QImageViewerBase::setZoomLevel()).
+         */
+    void setZoomLevel(int level);
+
+    QPointF centerPixel() const
+        { return centerPixel_; }
+
+        /**
+         * Set the (sub-pixel) image coordinates to be displayed at
+         * the center of the viewport.
+         */
+    void setCenterPixel(QPointF const &centerPixel);
+
+    QBrush background() const
+        { return background_; }
+
+        /**
+         * Set the brush filling the viewport outside of the image
+         * (default: Qt::darkGray).
+         */
+    void setBackground(QBrush const &brush);
+
+        /**
+         * Add an overlay (which is not owned by the renderer).
+         */
+    void addOverlay(Overlay *o);
+    void removeOverlay(Overlay *o);
+
+    OverlayViewer::Overlays overlays() const
+        { return overlays_; }
+
+        /**
+         * Return the position of the image origin in a viewport of
+         * the given size.
+         */
+    QPoint upperLeft(QSize const &viewportSize) const;
+
+        /**
+         * Paint the view into the given viewport of p.
+         */
+    void render(QPainter &p, QRect const &viewport) const;
+
+        /**
+         * Paint the view into target (which must have a format
+         * QPainter can paint on, e.g. Format_RGB32), whose size
+         * is the viewport size.
+         */
+    void render(QImage &target) const;
+
+        /**
+         * Return the view rendered into a new image of the given
+         * size and format.
+         */
+    QImage render(QSize const &size,
+                  QImage::Format format = QImage::Format_RGB32) const;
+
+  private:
+    QImage image_;
+    int zoomLevel_;
+    QPointF centerPixel_;
+    QBrush background_;
+    OverlayViewer::Overlays overlays_;
+};
+
+#endif // QIMAGEVIEWRENDERER_HXX
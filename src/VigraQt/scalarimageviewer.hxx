@@ -0,0 +1,212 @@
+#ifndef SCALARIMAGEVIEWER_HXX
+#define SCALARIMAGEVIEWER_HXX
+
+#include "fimageviewer.hxx"
+#include <QImage>
+#include <QVector>
+#include <algorithm>
+#include <limits>
+
+/**
+ * FImageViewer for scalar images of other pixel types, e.g.
+ * ScalarImageViewer<vigra::UInt16> for 12- or 16-bit camera data,
+ * without converting them to float first.  Supported are the types
+ * marked in ImageStatisticsTraits (8-, 16-, and 32-bit integers,
+ * float, and double).
+ *
+ * Pixel types with at most 16 bits are displayed via a lookup table
+ * (with 256 or 65536 entries) that is computed by FloatToByteMapping
+ * whenever the window or mode changes; other types are converted to
+ * float in small row chunks and mapped by FloatToByteMapping (so that
+ * double data is displayed with float precision).
+ *
+ * All signals, slots, and display settings are those of
+ * FImageViewer (whose setImage() / setImageView() for float data may
+ * still be used, releasing the data of type T).
+ */
+template <class T>
+class ScalarImageViewer : public FImageViewer
+{
+public:
+	typedef T value_type;
+
+	ScalarImageViewer(QWidget *parent = 0)
+	: FImageViewer(parent),
+	  copy_(0),
+	  view_(0),
+	  lutMin_(0.0f),
+	  lutMax_(0.0f),
+	  lutLogarithmic_(false),
+	  lutMarking_(false)
+	{}
+
+	~ScalarImageViewer()
+	{
+		delete copy_;
+	}
+
+	// (the float versions are still available)
+	using FImageViewer::setImage;
+	using FImageViewer::setImageView;
+
+	// display a copy of the given image (re-using the previous copy
+	// if the size did not change)
+	void setImage( const vigra::BasicImage<T> &newImage )
+	{
+		if(copy_ && copy_->size() == newImage.size())
+			std::copy(newImage.begin(), newImage.end(), copy_->begin());
+		else
+		{
+			delete copy_;
+			copy_ = new vigra::BasicImage<T>(newImage);
+		}
+
+		setTypedView(copy_->data(), copy_->width(), copy_->height(),
+					 copy_->width(), 1);
+	}
+
+	/**
+	 * Display the given data without copying it (see
+	 * FImageViewer::setImageView()).
+	 */
+	void setImageView( const T *data, int width, int height,
+					   int rowStride = 0, int pixelStride = 1 )
+	{
+		// the copy is no longer needed:
+		if(copy_ && copy_->data() != data)
+		{
+			delete copy_;
+			copy_ = 0;
+		}
+
+		setTypedView(data, width, height,
+					 rowStride ? rowStride : width, pixelStride);
+	}
+
+	template <class STRIDE>
+	void setImageView( vigra::MultiArrayView<2, T, STRIDE> const &view )
+	{
+		setImageView( view.data(), (int)view.shape(0), (int)view.shape(1),
+					  (int)view.stride(1), (int)view.stride(0) );
+	}
+
+protected:
+	enum {
+		// integer types of up to 16 bits are mapped via lookupTable_:
+		UseLookupTable = std::numeric_limits<T>::is_integer && sizeof(T) <= 2,
+		LookupTableSize =
+			UseLookupTable ? 1 << (UseLookupTable ? 8 * sizeof(T) : 0) : 0,
+		ChunkSize = 1024
+	};
+
+	void setTypedView( const T *data, int width, int height,
+					   int rowStride, int pixelStride )
+	{
+		// (data_ == 0 makes mapRect() use view_)
+		delete image_;
+		image_ = 0;
+		data_ = 0;
+
+		view_ = data;
+		width_ = width;
+		height_ = height;
+		rowStride_ = rowStride;
+		pixelStride_ = pixelStride;
+
+		statistics_.compute(data, width, height, rowStride, pixelStride);
+		showView();
+	}
+
+	// release the data of type T when float data is set
+	virtual void aboutToSetView()
+	{
+		delete copy_;
+		copy_ = 0;
+		view_ = 0;
+	}
+
+	virtual void mapRect(const QRect &r, QImage &byteImage)
+	{
+		// float data set via FImageViewer's API:
+		if(data_)
+		{
+			FImageViewer::mapRect(r, byteImage);
+			return;
+		}
+
+		FloatToByteMapping m(mapping());
+		if(UseLookupTable)
+			updateLookupTable(m);
+
+		for(int y = r.top(); y <= r.bottom(); ++y)
+		{
+			const T *src = view_ + (qint64)y * rowStride_
+						   + (qint64)r.left() * pixelStride_;
+			uchar *dest = byteImage.scanLine(y) + r.left();
+			if(UseLookupTable)
+			{
+				const uchar *lut = lookupTable_.constData()
+								   - (int)std::numeric_limits<T>::min();
+				for(int x = 0; x < r.width(); ++x, src += pixelStride_)
+					dest[x] = lut[(int)*src];
+			}
+			else
+				mapRow(m, src, pixelStride_, dest, r.width());
+		}
+	}
+
+	// (re-)compute lookupTable_ for the given mapping if necessary
+	void updateLookupTable(const FloatToByteMapping &m)
+	{
+		if(lookupTable_.size() == LookupTableSize &&
+		   lutMin_ == mappedMin_ && lutMax_ == mappedMax_ &&
+		   lutLogarithmic_ == logarithmicMode_ && lutMarking_ == markingMode_)
+			return;
+
+		lookupTable_.resize(LookupTableSize);
+		float values[ChunkSize];
+		for(int i = 0; i < LookupTableSize; i += ChunkSize)
+		{
+			int n = std::min((int)ChunkSize, LookupTableSize - i);
+			for(int j = 0; j < n; ++j)
+				values[j] = (float)((int)std::numeric_limits<T>::min() + i + j);
+			m.mapRow(values, 1, lookupTable_.data() + i, n);
+		}
+
+		lutMin_ = mappedMin_;
+		lutMax_ = mappedMax_;
+		lutLogarithmic_ = logarithmicMode_;
+		lutMarking_ = markingMode_;
+	}
+
+	static void mapRow(const FloatToByteMapping &m, const float *src,
+					   int pixelStride, uchar *dest, int width)
+	{
+		m.mapRow(src, pixelStride, dest, width);
+	}
+
+	// convert chunks of other types to float first
+	template <class U>
+	static void mapRow(const FloatToByteMapping &m, const U *src,
+					   int pixelStride, uchar *dest, int width)
+	{
+		float values[ChunkSize];
+		for(int x = 0; x < width; x += ChunkSize)
+		{
+			int n = std::min((int)ChunkSize, width - x);
+			for(int i = 0; i < n; ++i, src += pixelStride)
+				values[i] = (float)*src;
+			m.mapRow(values, 1, dest + x, n);
+		}
+	}
+
+	vigra::BasicImage<T> *copy_; // copy made by setImage(), if any
+	const T *view_;
+
+	QVector<uchar> lookupTable_;
+	// the window and mode lookupTable_ was computed for:
+	float lutMin_, lutMax_;
+	bool lutLogarithmic_, lutMarking_;
+};
+
+#endif // SCALARIMAGEVIEWER_HXX
@@ -0,0 +1,644 @@
+/*
+ * vigraqt_bench - microbenchmarks of VigraQt's rendering hot paths.
+ *
+ * USAGE: vigraqt_bench [--output results.json] [--filter substring]
+ *                      [--min-time milliseconds] [--list]
+ *
+ * Every benchmark is run repeatedly for at least --min-time (default:
+ * 200ms, but at least MinIterations times) after one warm-up run, and
+ * the minimum, median, and mean wall-clock time per iteration are
+ * reported.  Results are written as JSON (to stdout by default), so
+ * that different builds can be compared by benchmark name and
+ * parameters.
+ *
+ * No window is ever shown, but Qt 4 still needs an X server; run the
+ * benchmarks e.g. under "xvfb-run vigraqt_bench" on headless machines
+ * (or with QT_QPA_PLATFORM=offscreen where available).
+ */
+
+#include <VigraQt/cmgradient.hxx>
+#include <VigraQt/colormap.hxx>
+#include <VigraQt/createqimage.hxx>
+#include <VigraQt/fimageviewer.hxx>
+#include <VigraQt/floattobyte.hxx>
+#include <VigraQt/imagestatistics.hxx>
+#include <VigraQt/imagezoom.hxx>
+#include <VigraQt/overlayviewer.hxx>
+#include <VigraQt/qimageviewer.hxx>
+#include <VigraQt/scalarimageviewer.hxx>
+
+#include <vigra/stdimage.hxx>
+
+#include <QApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QPainter>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+enum { MinIterations = 5, ImageSize = 1024 };
+
+/********************************************************************/
+/*                                                                  */
+/*                         benchmark runner                         */
+/*                                                                  */
+/********************************************************************/
+
+class Benchmark
+{
+  public:
+    Benchmark(QString const &name, QString const &params)
+    : name_(name), params_(params)
+    {}
+
+    virtual ~Benchmark()
+    {}
+
+    QString name() const
+        { return name_; }
+
+        // "key=value key=value" identifying this variant
+    QString params() const
+        { return params_; }
+
+        // number of pixels processed per iteration (for throughput)
+    virtual qint64 pixels() const = 0;
+
+        // one iteration of the measured operation
+    virtual void run() = 0;
+
+  private:
+    QString name_, params_;
+};
+
+struct BenchmarkResult
+{
+    QString name, params;
+    int iterations;
+    qint64 minTime, medianTime, meanTime; // nanoseconds per iteration
+    qint64 pixels;
+};
+
+static BenchmarkResult measure(Benchmark &benchmark, qint64 minTime)
+{
+    benchmark.run(); // warm-up (caches, lazy initialization)
+
+    std::vector<qint64> times;
+    QElapsedTimer total;
+    total.start();
+    while((int)times.size() < MinIterations || total.nsecsElapsed() < minTime)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        benchmark.run();
+        times.push_back(timer.nsecsElapsed());
+    }
+
+    BenchmarkResult result;
+    result.name = benchmark.name();
+    result.params = benchmark.params();
+    result.iterations = times.size();
+    result.pixels = benchmark.pixels();
+
+    std::sort(times.begin(), times.end());
+    result.minTime = times.front();
+    result.medianTime = times[times.size() / 2];
+    qint64 sum = 0;
+    for(unsigned int i = 0; i < times.size(); ++i)
+        sum += times[i];
+    result.meanTime = sum / (qint64)times.size();
+    return result;
+}
+
+static QString jsonString(QString const &s)
+{
+    QString result(s);
+    result.replace("\\", "\\\\");
+    result.replace("\"", "\\\"");
+    return "\"" + result + "\"";
+}
+
+static void writeJSON(QTextStream &out, QList<BenchmarkResult> const &results)
+{
+    out << "{\n";
+    out << "  \"qtVersion\": " << jsonString(qVersion()) << ",\n";
+    out << "  \"idealThreadCount\": " << QThread::idealThreadCount() << ",\n";
+    out << "  \"date\": " << jsonString(
+        QDateTime::currentDateTime().toString(Qt::ISODate)) << ",\n";
+    out << "  \"results\": [";
+    for(int i = 0; i < results.size(); ++i)
+    {
+        BenchmarkResult const &r(results[i]);
+        double mpixPerSec = r.medianTime
+            ? r.pixels * 1e3 / r.medianTime : 0.0;
+        out << (i ? ",\n" : "\n")
+            << "    {\"name\": " << jsonString(r.name)
+            << ", \"params\": " << jsonString(r.params)
+            << ", \"iterations\": " << r.iterations
+            << ", \"minNs\": " << r.minTime
+            << ", \"medianNs\": " << r.medianTime
+            << ", \"meanNs\": " << r.meanTime
+            << ", \"pixels\": " << r.pixels
+            << ", \"mpixPerSec\": " << QString::number(mpixPerSec, 'f', 2)
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+/********************************************************************/
+/*                                                                  */
+/*                          test images                             */
+/*                                                                  */
+/********************************************************************/
+
+// deterministic, non-trivial pixel values (no random numbers, so
+// that all runs process the same data)
+static double testValue(int x, int y)
+{
+    return 0.5 + 0.25 * sin(x * 0.05) + 0.25 * cos(y * 0.031 + x * 0.007);
+}
+
+static QImage testQImage(QImage::Format format)
+{
+    QImage image(ImageSize, ImageSize, QImage::Format_ARGB32);
+    for(int y = 0; y < image.height(); ++y)
+    {
+        QRgb *row = (QRgb *)image.scanLine(y);
+        for(int x = 0; x < image.width(); ++x)
+        {
+            int v = (int)(255 * testValue(x, y));
+            row[x] = qRgba(v, 255 - v, (x ^ y) & 0xff, 255);
+        }
+    }
+    return image.convertToFormat(format);
+}
+
+static vigra::FImage testFImage()
+{
+    vigra::FImage image(ImageSize, ImageSize);
+    for(int y = 0; y < image.height(); ++y)
+        for(int x = 0; x < image.width(); ++x)
+            image(x, y) = (float)(1000.0 * testValue(x, y) - 200.0);
+    return image;
+}
+
+/********************************************************************/
+/*                                                                  */
+/*                            benchmarks                            */
+/*                                                                  */
+/********************************************************************/
+
+// exposes the protected zoom kernel entry point
+class BenchImageViewer : public QImageViewer
+{
+  public:
+    using QImageViewer::zoomImage;
+};
+
+class ZoomImageBenchmark : public Benchmark
+{
+  public:
+    ZoomImageBenchmark(QString const &formatName, QImage::Format format,
+                       int level, int threads)
+    : Benchmark("QImageViewer::zoomImage",
+                QString("format=%1 level=%2 threads=%3")
+                .arg(formatName).arg(level).arg(threads)),
+      dest_(level < 0 ? ImageSize / (1 - level) : ImageSize,
+            level < 0 ? ImageSize / (1 - level) : ImageSize, format)
+    {
+        // (when subsampling, dest_ must not exceed the zoomed image)
+        viewer_.setImage(testQImage(format));
+        viewer_.setZoomLevel(level);
+        viewer_.setRenderThreadCount(threads);
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)dest_.width() * dest_.height(); }
+
+    virtual void run()
+        { viewer_.zoomImage(0, 0, dest_); }
+
+  private:
+    BenchImageViewer viewer_;
+    QImage dest_;
+};
+
+template<class IMAGE>
+class CreateQImageBenchmark : public Benchmark
+{
+  public:
+    CreateQImageBenchmark(QString const &type, IMAGE const &image)
+    : Benchmark("vigra::createQImage", "type=" + type),
+      image_(image)
+    {}
+
+    virtual qint64 pixels() const
+        { return (qint64)image_.width() * image_.height(); }
+
+    virtual void run()
+        { delete vigra::createQImage(srcImageRange(image_)); }
+
+  private:
+    IMAGE image_;
+};
+
+class ColorMapBenchmark : public Benchmark
+{
+  public:
+    ColorMapBenchmark(QString const &mapName, BuiltinColorMap cm)
+    : Benchmark("ColorMap::operator()", "map=" + mapName),
+      colorMap_(createColorMap(cm)),
+      image_(testFImage()),
+      dest_(ImageSize, ImageSize, QImage::Format_RGB32)
+    {
+        colorMap_->setDomain(-200.0f, 800.0f);
+    }
+
+    ~ColorMapBenchmark()
+    {
+        delete colorMap_;
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)image_.width() * image_.height(); }
+
+    virtual void run()
+    {
+        for(int y = 0; y < image_.height(); ++y)
+        {
+            QRgb *row = (QRgb *)dest_.scanLine(y);
+            for(int x = 0; x < image_.width(); ++x)
+            {
+                ColorMap::Color c((*colorMap_)(image_(x, y)));
+                row[x] = qRgb(c.red(), c.green(), c.blue());
+            }
+        }
+    }
+
+  private:
+    ColorMap *colorMap_;
+    vigra::FImage image_;
+    QImage dest_;
+};
+
+// exposes the protected conversion of the float image
+class BenchFImageViewer : public FImageViewer
+{
+  public:
+    using FImageViewer::redisplay;
+};
+
+class RedisplayBenchmark : public Benchmark
+{
+  public:
+    RedisplayBenchmark(bool logarithmic)
+    : Benchmark("FImageViewer::redisplay",
+                QString("logarithmic=%1").arg(logarithmic ? 1 : 0))
+    {
+        viewer_.setLogarithmicMode(logarithmic);
+        viewer_.setImage(testFImage());
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)ImageSize * ImageSize; }
+
+    virtual void run()
+        { viewer_.redisplay(-100.0f, 700.0f); }
+
+  private:
+    BenchFImageViewer viewer_;
+};
+
+// exposes the protected conversion of the scalar image
+template<class T>
+class BenchScalarImageViewer : public ScalarImageViewer<T>
+{
+  public:
+    using ScalarImageViewer<T>::redisplay;
+};
+
+template<class T>
+class ScalarRedisplayBenchmark : public Benchmark
+{
+  public:
+    ScalarRedisplayBenchmark(QString const &type, double scale)
+    : Benchmark("ScalarImageViewer::redisplay", "type=" + type)
+    {
+        vigra::BasicImage<T> image(ImageSize, ImageSize);
+        for(int y = 0; y < ImageSize; ++y)
+            for(int x = 0; x < ImageSize; ++x)
+                image(x, y) = (T)(scale * testValue(x, y));
+        viewer_.setImage(image);
+        min_ = (float)(0.1 * scale);
+        max_ = (float)(0.9 * scale);
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)ImageSize * ImageSize; }
+
+    virtual void run()
+        { viewer_.redisplay(min_, max_); }
+
+  private:
+    BenchScalarImageViewer<T> viewer_;
+    float min_, max_;
+};
+
+class FloatToByteBenchmark : public Benchmark
+{
+  public:
+    FloatToByteBenchmark(QString const &isName, ImageZoom::InstructionSet is,
+                         FloatToByteMapping::Mode mode, bool marking)
+    : Benchmark("FloatToByteMapping::mapRows",
+                QString("isa=%1 mode=%2 marking=%3").arg(isName)
+                .arg(mode == FloatToByteMapping::Logarithmic ? "log" : "linear")
+                .arg(marking ? 1 : 0)),
+      image_(testFImage()),
+      dest_(ImageSize, ImageSize, QImage::Format_Indexed8),
+      mapping_(0)
+    {
+        // (the kernels are chosen when the mapping is constructed)
+        ImageZoom::InstructionSet previous = ImageZoom::instructionSet();
+        ImageZoom::setInstructionSet(is);
+        mapping_ = new FloatToByteMapping(-100.0f, 700.0f, mode, marking);
+        ImageZoom::setInstructionSet(previous);
+    }
+
+    ~FloatToByteBenchmark()
+    {
+        delete mapping_;
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)image_.width() * image_.height(); }
+
+    virtual void run()
+    {
+        mapping_->mapRows(image_.data(), image_.width(), image_.width(), 1,
+                          dest_.bits(), dest_.bytesPerLine(),
+                          0, image_.height());
+    }
+
+  private:
+    vigra::FImage image_;
+    QImage dest_;
+    FloatToByteMapping *mapping_;
+};
+
+class StatisticsBenchmark : public Benchmark
+{
+  public:
+    StatisticsBenchmark(int threads)
+    : Benchmark("ImageStatistics::compute", QString("threads=%1").arg(threads)),
+      image_(testFImage())
+    {
+        statistics_.setThreadCount(threads);
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)image_.width() * image_.height(); }
+
+    virtual void run()
+        { statistics_.compute(image_.data(), image_.width(), image_.height()); }
+
+  private:
+    vigra::FImage image_;
+    ImageStatistics statistics_;
+};
+
+class EdgeOverlayBenchmark : public Benchmark
+{
+  public:
+    enum { EdgeLength = 20 };
+
+    EdgeOverlayBenchmark(int edgeCount)
+    : Benchmark("EdgeOverlayBase::draw",
+                QString("edges=%1 points=%2").arg(edgeCount).arg(EdgeLength)),
+      target_(ImageSize, ImageSize, QImage::Format_ARGB32_Premultiplied)
+    {
+        std::vector<vigra::Diff2D> edge(EdgeLength);
+        for(int e = 0; e < edgeCount; ++e)
+        {
+            // short random-looking polylines covering the image:
+            int x0 = (e * 7919) % ImageSize, y0 = (e * 104729) % ImageSize;
+            for(int i = 0; i < EdgeLength; ++i)
+                edge[i] = vigra::Diff2D(
+                    std::min(ImageSize - 1, x0 + i),
+                    std::min(ImageSize - 1,
+                             y0 + (int)(8 * testValue(x0 + i, e))));
+            overlay_.setEdge(e, edge.begin(), edge.end());
+        }
+        overlay_.setZoomLevel(0);
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)target_.width() * target_.height(); }
+
+    virtual void run()
+    {
+        QPainter p(&target_);
+        overlay_.draw(p, target_.rect());
+    }
+
+  private:
+    EdgeOverlay<vigra::Diff2D> overlay_;
+    QImage target_;
+};
+
+class GradientBenchmark : public Benchmark
+{
+  public:
+    GradientBenchmark(QSize const &size)
+    : Benchmark("ColorMapGradient::paintEvent",
+                QString("size=%1x%2").arg(size.width()).arg(size.height())),
+      gradient_(0),
+      colorMap_(createColorMap(CMFire)),
+      target_(size, QImage::Format_ARGB32_Premultiplied)
+    {
+        gradient_.setColorMap(colorMap_);
+        gradient_.resize(size);
+    }
+
+    ~GradientBenchmark()
+    {
+        gradient_.setColorMap(0);
+        delete colorMap_;
+    }
+
+    virtual qint64 pixels() const
+        { return (qint64)target_.width() * target_.height(); }
+
+        // QWidget::render() calls paintEvent() without showing the
+        // widget:
+    virtual void run()
+        { gradient_.render(&target_); }
+
+  private:
+    ColorMapGradient gradient_;
+    ColorMap *colorMap_;
+    QImage target_;
+};
+
+/********************************************************************/
+
+static QList<Benchmark *> createBenchmarks()
+{
+    QList<Benchmark *> result;
+
+    struct { const char *name; QImage::Format format; } formats[] = {
+        { "Mono", QImage::Format_Mono },
+        { "Indexed8", QImage::Format_Indexed8 },
+        { "RGB16", QImage::Format_RGB16 },
+        { "RGB888", QImage::Format_RGB888 },
+        { "RGB32", QImage::Format_RGB32 },
+        { "ARGB32", QImage::Format_ARGB32 },
+    };
+    for(unsigned int f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f)
+        for(int level = -4; level <= 8; ++level)
+            result.append(new ZoomImageBenchmark(
+                formats[f].name, formats[f].format, level, 1));
+    for(int level = -1; level <= 3; level += 4)
+        result.append(new ZoomImageBenchmark(
+            "RGB32", QImage::Format_RGB32, level,
+            std::max(1, QThread::idealThreadCount())));
+
+    vigra::BImage gray(ImageSize, ImageSize);
+    vigra::BRGBImage rgb(ImageSize, ImageSize);
+    vigra::FImage floats(testFImage());
+    for(int y = 0; y < ImageSize; ++y)
+        for(int x = 0; x < ImageSize; ++x)
+        {
+            int v = (int)(255 * testValue(x, y));
+            gray(x, y) = v;
+            rgb(x, y) = vigra::RGBValue<unsigned char>(v, 255 - v, x ^ y);
+        }
+    result.append(new CreateQImageBenchmark<vigra::BImage>("gray", gray));
+    result.append(new CreateQImageBenchmark<vigra::BRGBImage>("rgb", rgb));
+    result.append(new CreateQImageBenchmark<vigra::FImage>("float", floats));
+
+    result.append(new ColorMapBenchmark("gray", CMGray));
+    result.append(new ColorMapBenchmark("linearGray", CMLinearGray));
+    result.append(new ColorMapBenchmark("fire", CMFire));
+    result.append(new ColorMapBenchmark("fireNegativeBlue", CMFireNegativeBlue));
+
+    result.append(new RedisplayBenchmark(false));
+    result.append(new RedisplayBenchmark(true));
+
+    result.append(new ScalarRedisplayBenchmark<vigra::UInt8>("uint8", 255));
+    result.append(new ScalarRedisplayBenchmark<vigra::UInt16>("uint16", 65535));
+    result.append(new ScalarRedisplayBenchmark<vigra::Int32>("int32", 1e6));
+    result.append(new ScalarRedisplayBenchmark<double>("double", 1000));
+
+    struct { const char *name; ImageZoom::InstructionSet is; } isas[] = {
+        { "scalar", ImageZoom::Scalar },
+        { "sse2", ImageZoom::SSE2 },
+        { "avx2", ImageZoom::AVX2 },
+    };
+    for(unsigned int i = 0; i < sizeof(isas) / sizeof(isas[0]); ++i)
+    {
+        // (unsupported instruction sets would duplicate another variant)
+        if(isas[i].is > ImageZoom::supportedInstructionSet())
+            continue;
+        for(int marking = 0; marking < 2; ++marking)
+        {
+            result.append(new FloatToByteBenchmark(
+                isas[i].name, isas[i].is,
+                FloatToByteMapping::Linear, marking != 0));
+            result.append(new FloatToByteBenchmark(
+                isas[i].name, isas[i].is,
+                FloatToByteMapping::Logarithmic, marking != 0));
+        }
+    }
+
+    result.append(new StatisticsBenchmark(1));
+    if(QThread::idealThreadCount() > 1)
+        result.append(new StatisticsBenchmark(QThread::idealThreadCount()));
+
+    result.append(new EdgeOverlayBenchmark(1000));
+    result.append(new EdgeOverlayBenchmark(10000));
+    result.append(new EdgeOverlayBenchmark(100000));
+
+    result.append(new GradientBenchmark(QSize(256, 24)));
+    result.append(new GradientBenchmark(QSize(1024, 64)));
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    QApplication app(argc, argv);
+
+    QString outputName, filter;
+    qint64 minTime = 200 * 1000000LL;
+    bool listOnly = false;
+    QStringList args(app.arguments());
+    for(int i = 1; i < args.size(); ++i)
+    {
+        if(args[i] == "--output" && i + 1 < args.size())
+            outputName = args[++i];
+        else if(args[i] == "--filter" && i + 1 < args.size())
+            filter = args[++i];
+        else if(args[i] == "--min-time" && i + 1 < args.size())
+            minTime = args[++i].toLongLong() * 1000000LL;
+        else if(args[i] == "--list")
+            listOnly = true;
+        else
+        {
+            QTextStream(stderr)
+                << "USAGE: " << args[0] << " [--output results.json]"
+                << " [--filter substring] [--min-time milliseconds]"
+                << " [--list]\n";
+            return 1;
+        }
+    }
+
+    QTextStream err(stderr);
+    QList<Benchmark *> benchmarks(createBenchmarks());
+    QList<BenchmarkResult> results;
+    foreach(Benchmark *benchmark, benchmarks)
+    {
+        QString id(benchmark->name() + " " + benchmark->params());
+        if(!filter.isEmpty() && !id.contains(filter))
+            continue;
+
+        if(listOnly)
+        {
+            err << id << "\n";
+            continue;
+        }
+
+        BenchmarkResult result(measure(*benchmark, minTime));
+        err << id << ": " << QString::number(result.medianTime / 1e6, 'f', 3)
+            << " ms (" << result.iterations << " iterations)\n";
+        err.flush();
+        results.append(result);
+    }
+    qDeleteAll(benchmarks);
+
+    if(listOnly)
+        return 0;
+
+    if(outputName.isEmpty())
+    {
+        QTextStream out(stdout);
+        writeJSON(out, results);
+        return 0;
+    }
+
+    QFile output(outputName);
+    if(!output.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        err << "could not write '" << outputName << "'!\n";
+        return 1;
+    }
+    QTextStream out(&output);
+    writeJSON(out, results);
+    return 0;
+}
@@ -0,0 +1,10 @@
+TEMPLATE     = app
+CONFIG      += qt warn_on release
+CONFIG      -= app_bundle
+
+TARGET       = vigraqt_bench
+
+INCLUDEPATH += .. $$system( vigra-config --cppflags | sed "s,-I,,g" )
+LIBS        += -lVigraQt -L../VigraQt
+
+SOURCES     += vigraqt_bench.cxx
@@ -7,7 +7,7 @@ or
   nosetests test_viewer.py
 """
 
-import sys
+import sys, os, shutil, tempfile
 from PyQt4 import QtCore, QtGui
 import VigraQt
 
@@ -37,6 +37,42 @@ def showImage(array):
 	result.show()
 	return result
 
+formats = [
+	QtGui.QImage.Format_Mono, QtGui.QImage.Format_MonoLSB,
+	QtGui.QImage.Format_Indexed8,
+	QtGui.QImage.Format_RGB32, QtGui.QImage.Format_ARGB32,
+	QtGui.QImage.Format_ARGB32_Premultiplied,
+	QtGui.QImage.Format_RGB16, QtGui.QImage.Format_ARGB8565_Premultiplied,
+	QtGui.QImage.Format_RGB666, QtGui.QImage.Format_ARGB6666_Premultiplied,
+	QtGui.QImage.Format_RGB555, QtGui.QImage.Format_ARGB8555_Premultiplied,
+	QtGui.QImage.Format_RGB888,
+	QtGui.QImage.Format_RGB444, QtGui.QImage.Format_ARGB4444_Premultiplied,
+	]
+
+def colorImage(w, h, seed = 42):
+	rgb = numpy.random.RandomState(seed).randint(0, 256, (h, w, 3))
+	return array2qimage(rgb.astype(numpy.uint8))
+
+def sameImage(a, b):
+	if a.size() != b.size():
+		return False
+	return (a.convertToFormat(QtGui.QImage.Format_ARGB32) ==
+			b.convertToFormat(QtGui.QImage.Format_ARGB32))
+
+def instructionSets():
+	"""Iterate over all instruction sets supported by the CPU, making
+	each the one used by the zoom kernels in turn."""
+	previous = VigraQt.ImageZoom.instructionSet()
+	supported = VigraQt.ImageZoom.supportedInstructionSet()
+	try:
+		for iset in (VigraQt.ImageZoom.Scalar, VigraQt.ImageZoom.SSE2,
+					 VigraQt.ImageZoom.SSSE3, VigraQt.ImageZoom.AVX2):
+			if iset <= supported:
+				VigraQt.ImageZoom.setInstructionSet(iset)
+				yield iset
+	finally:
+		VigraQt.ImageZoom.setInstructionSet(previous)
+
 app = QtGui.QApplication(sys.argv)
 
 qimg = QtGui.QImage("../../examples/example.png")
@@ -98,3 +134,180 @@ def test_viewer_at_50percent():
 	assert numpy.all(rgb_view(out)[96:-96,96:-96] ==
 					 rgb_view(reference)[::2,::2])
 
+
+def test_zoomRegion_magnification():
+	image = colorImage(100, 30)
+	for fmt in formats:
+		src = image.convertToFormat(fmt)
+		for iset in instructionSets():
+			for level in (1, 2, 3):
+				for roi in (src.rect(), QtCore.QRect(5, 3, 90, 20)):
+					zoomed = VigraQt.QImageViewer.zoomRegion(src, roi, level)
+					expected = src.copy(roi).scaled(
+						roi.size() * (level + 1), QtCore.Qt.IgnoreAspectRatio,
+						QtCore.Qt.FastTransformation)
+					assert zoomed.format() == fmt
+					assert sameImage(zoomed, expected), (fmt, iset, level, roi)
+
+def test_zoomRegion_subsampling():
+	# subsample images made of f x f blocks, so that the result does
+	# not depend on which pixel of each block is sampled:
+	for fmt in formats:
+		small = colorImage(30, 8).convertToFormat(fmt)
+		for f in (2, 3, 4):
+			big = small.scaled(small.size() * f, QtCore.Qt.IgnoreAspectRatio,
+							   QtCore.Qt.FastTransformation)
+			for iset in instructionSets():
+				zoomed = VigraQt.QImageViewer.zoomRegion(big, big.rect(), 1 - f)
+				assert zoomed.format() == fmt
+				assert sameImage(zoomed, small), (fmt, iset, f)
+
+def test_scaleRegion_fractional():
+	# the source positions (x + 0.5) / f of these factors never fall
+	# onto pixel boundaries, where the rounding of QImage::scaled()
+	# differs:
+	for fmt in formats:
+		image = colorImage(100, 60).convertToFormat(fmt)
+		for f in (0.6, 0.4, 1.4, 1.8):
+			expected = image.scaled(
+				QtCore.QSize(int(round(100 * f)), int(round(60 * f))),
+				QtCore.Qt.IgnoreAspectRatio, QtCore.Qt.FastTransformation)
+			for iset in instructionSets():
+				scaled = VigraQt.QImageViewer.scaleRegion(
+					image, expected.rect(), f, 0, False)
+				assert scaled.format() == fmt
+				assert sameImage(scaled, expected), (fmt, iset, f)
+
+def checkROIUpdate(update, fmt, roiFormat = None, pos = QtCore.QPoint(13, 7)):
+	image = colorImage(64, 48, 1).convertToFormat(fmt)
+	roi = colorImage(20, 10, 2).convertToFormat(roiFormat or fmt)
+	v = VigraQt.QImageViewer()
+	v.setImage(image)
+	update(v, roi, pos)
+
+	target = QtCore.QRect(pos, roi.size()) & image.rect()
+	result = v.originalImage()
+	assert result.format() == fmt
+	assert sameImage(result.copy(target),
+					 roi.convertToFormat(fmt).copy(target.translated(-pos)))
+
+	# everything around the ROI must be unchanged:
+	for rect in (QtCore.QRect(0, 0, 64, target.top()),
+				 QtCore.QRect(0, target.bottom() + 1, 64, 47 - target.bottom()),
+				 QtCore.QRect(0, target.top(), target.left(), target.height()),
+				 QtCore.QRect(target.right() + 1, target.top(),
+							  63 - target.right(), target.height())):
+		if not rect.isEmpty():
+			assert sameImage(result.copy(rect), image.copy(rect)), rect
+
+def updateROI(v, roi, pos):
+	v.updateROI(roi, pos)
+
+def postROI(v, roi, pos):
+	v.postROI(roi, pos)
+	v.flushDirty()
+
+def test_updateROI():
+	for update in (updateROI, postROI):
+		for fmt in (QtGui.QImage.Format_Mono, QtGui.QImage.Format_RGB16,
+					QtGui.QImage.Format_RGB888):
+			checkROIUpdate(update, fmt)
+
+def test_updateROI_converts():
+	# same pixel size, but different layout:
+	checkROIUpdate(updateROI, QtGui.QImage.Format_RGB16,
+				   QtGui.QImage.Format_RGB555)
+	checkROIUpdate(updateROI, QtGui.QImage.Format_RGB888,
+				   QtGui.QImage.Format_RGB32)
+
+def test_updateROI_clipped():
+	for fmt in (QtGui.QImage.Format_Mono, QtGui.QImage.Format_RGB16,
+				QtGui.QImage.Format_RGB888):
+		checkROIUpdate(updateROI, fmt, pos = QtCore.QPoint(55, 40))
+		checkROIUpdate(updateROI, fmt, pos = QtCore.QPoint(-6, -3))
+
+def test_rawfilesource_roundtrip():
+	tempdir = tempfile.mkdtemp()
+	try:
+		fn = os.path.join(tempdir, "test.raw")
+		roi = QtCore.QRect(3, 5, 30, 11)
+		for fmt in (QtGui.QImage.Format_Mono, QtGui.QImage.Format_Indexed8,
+					QtGui.QImage.Format_RGB16, QtGui.QImage.Format_RGB888,
+					QtGui.QImage.Format_RGB32,
+					QtGui.QImage.Format_ARGB32_Premultiplied):
+			# (odd width, so that rows need padding)
+			image = colorImage(37, 23).convertToFormat(fmt)
+			assert VigraQt.QImageRawFileSource.save(image, fn)
+
+			source = VigraQt.QImageRawFileSource(fn)
+			assert source.isValid(), source.errorString()
+			assert source.size() == image.size()
+			assert source.format() == fmt
+			assert sameImage(source.region(image.rect()), image)
+			assert sameImage(source.region(roi), image.copy(roi)), fmt
+			del source
+	finally:
+		shutil.rmtree(tempdir)
+
+def test_rawfilesource_unaligned():
+	tempdir = tempfile.mkdtemp()
+	try:
+		fn = os.path.join(tempdir, "test.rgb")
+		image = colorImage(37, 23).convertToFormat(QtGui.QImage.Format_RGB888)
+		bits = image.constBits().asstring(image.byteCount())
+		f = open(fn, "wb")
+		f.write("\0")
+		for y in range(image.height()):
+			start = y * image.bytesPerLine()
+			f.write(bits[start:start + 37 * 3])
+		f.close()
+
+		source = VigraQt.QImageRawFileSource(
+			fn, image.size(), QtGui.QImage.Format_RGB888, 37 * 3, 1)
+		assert source.isValid(), source.errorString()
+		roi = QtCore.QRect(3, 5, 30, 11)
+		assert sameImage(source.region(image.rect()), image)
+		assert sameImage(source.region(roi), image.copy(roi))
+		del source
+	finally:
+		shutil.rmtree(tempdir)
+
+def test_renderer_matches_viewer():
+	v = VigraQt.OverlayViewer()
+	v.setImage(qimg)
+	v.resize(100, 80)
+	v.show()
+	for level in (-1, 0, 2):
+		v.setZoomLevel(level)
+		v.setCenterPixel(QtCore.QPointF(70.3, 50.8))
+
+		r = VigraQt.QImageViewRenderer(qimg)
+		r.setZoomLevel(level)
+		r.setCenterPixel(v.centerPixelF())
+		r.setBackground(QtGui.QBrush(QtCore.Qt.black))
+		out = r.render(v.size())
+		assert numpy.all(rgb_view(out) == rgb_view(getWidgetImage(v))), level
+
+class RecordingOverlay(VigraQt.Overlay):
+	def __init__(self):
+		VigraQt.Overlay.__init__(self)
+		self.drawCount = 0
+
+	def draw(self, painter, rect):
+		self.drawCount += 1
+
+def test_renderer_skips_viewer_overlays():
+	v = VigraQt.OverlayViewer()
+	v.setImage(qimg)
+	shared = RecordingOverlay()
+	v.addOverlay(shared)
+	assert shared.viewer() is not None
+	own = RecordingOverlay()
+	assert own.viewer() is None
+
+	r = VigraQt.QImageViewRenderer(qimg)
+	r.addOverlay(shared)
+	r.addOverlay(own)
+	r.render(QtCore.QSize(50, 40))
+	assert shared.drawCount == 0
+	assert own.drawCount == 1